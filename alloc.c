@@ -0,0 +1,193 @@
+/*
+ * alloc.c
+ *
+ *     Version: $Id$
+ *
+ * Library for keeping the allocator off of the simulation's hot paths. Every
+ * pool and ring buffer is sized and allocated before any actor starts, and is
+ * accounted for by name so that the report can say how much memory was
+ * preallocated.
+ *
+ * When built with ALLOC_DEBUG, this file also interposes malloc, calloc,
+ * realloc, and free, forwarding them to glibc's __libc_ versions and counting
+ * them by phase. The phase is global, but a thread can override it for
+ * itself, e.g. the control thread, whose hiring and retiring of actors is
+ * allowed to allocate. A run that allocates or frees anything in the steady
+ * phase is considered to have failed. Allocations made through other entry
+ * points, such as posix_memalign or mmap, aren't counted.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+#include "alloc.h"
+
+typedef struct {
+    const char *name;
+    unsigned long size;
+} pool_t;
+
+static pool_t pools[ALLOC_MAX_POOLS];
+static int num_pools = 0;
+
+static alloc_phase_t global_phase = ALLOC_PHASE_SETUP;
+
+/* -1 if the thread follows the global phase. */
+static __thread int thread_phase = -1;
+
+#if ALLOC_DEBUG
+
+static const char *phase_names[] = {"setup", "steady", "control", "teardown"};
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t num_items, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static unsigned long num_allocs[ALLOC_NUM_PHASES];
+static unsigned long num_frees[ALLOC_NUM_PHASES];
+static unsigned long num_bytes[ALLOC_NUM_PHASES];
+
+/**
+ * Count an allocation or free against the calling thread's phase.
+ */
+static void count(unsigned long *counts, const unsigned long amount) {
+    int phase = thread_phase;
+    if(0 > phase) {
+        phase = (int) __atomic_load_n(&global_phase, __ATOMIC_RELAXED);
+    }
+    __sync_fetch_and_add(&(counts[phase]), amount);
+}
+
+void *malloc(size_t size) {
+    count(num_allocs, 1);
+    count(num_bytes, (unsigned long) size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t num_items, size_t size) {
+    count(num_allocs, 1);
+    count(num_bytes, (unsigned long) (num_items * size));
+    return __libc_calloc(num_items, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count(num_allocs, 1);
+    count(num_bytes, (unsigned long) size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if(NULL != ptr) {
+        count(num_frees, 1);
+    }
+    __libc_free(ptr);
+}
+
+#endif /* ALLOC_DEBUG */
+
+/**
+ * Move the whole program into a new phase. Threads that have overridden
+ * their phase stay in it.
+ */
+void alloc_phase(const alloc_phase_t phase) {
+    assert(0 <= phase && phase < ALLOC_NUM_PHASES);
+    __atomic_store_n(&global_phase, phase, __ATOMIC_RELAXED);
+}
+
+/**
+ * Put the calling thread into a phase of its own, regardless of the global
+ * phase.
+ */
+void alloc_thread_phase(const alloc_phase_t phase) {
+    assert(0 <= phase && phase < ALLOC_NUM_PHASES);
+    thread_phase = (int) phase;
+}
+
+/**
+ * Record memory that was preallocated by some other means, e.g. a static
+ * buffer or a mapping. Pools with the same name are added together. This
+ * must only be called during setup.
+ */
+void alloc_account(const char *name, const size_t size) {
+    int i;
+
+    assert(NULL != name);
+
+    for(i = 0; i < num_pools; ++i) {
+        if(!strcmp(name, pools[i].name)) {
+            pools[i].size += (unsigned long) size;
+            return;
+        }
+    }
+
+    assert(num_pools < ALLOC_MAX_POOLS);
+    pools[num_pools].name = name;
+    pools[num_pools].size = (unsigned long) size;
+    ++num_pools;
+}
+
+/**
+ * Allocate a pool up front and touch all of it, so that neither the
+ * allocator nor page faults show up once the simulation is running.
+ *
+ * Params: - Name to account the pool under.
+ *         - Size of the pool in bytes.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void *alloc_pool(const char *name, const size_t size) {
+    void *pool;
+
+    assert(0 < size);
+
+    pool = malloc(size);
+    if(NULL == pool) {
+        perror("alloc_pool[malloc]");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(pool, 0, size);
+    alloc_account(name, size);
+    return pool;
+}
+
+/**
+ * Print out the preallocated pools and, if counting, the allocations made in
+ * each phase.
+ *
+ * Returns: the number of allocations and frees made in the steady phase,
+ *          which is always 0 unless built with ALLOC_DEBUG.
+ */
+unsigned long alloc_report(FILE *out) {
+    unsigned long total = 0;
+    unsigned long num_steady = 0;
+    int i;
+
+    fprintf(out, "preallocated memory:\n");
+    for(i = 0; i < num_pools; ++i) {
+        fprintf(out, "    %-24s %10lu bytes\n", pools[i].name, pools[i].size);
+        total += pools[i].size;
+    }
+    fprintf(out, "    %-24s %10lu bytes (%.1fMB)\n",
+        "total", total, (double) total / (1 << 20)
+    );
+
+#if ALLOC_DEBUG
+    fprintf(out, "allocations by phase:\n");
+    for(i = 0; i < ALLOC_NUM_PHASES; ++i) {
+        fprintf(out, "    %-24s %6lu allocs (%lu bytes), %lu frees\n",
+            phase_names[i], num_allocs[i], num_bytes[i], num_frees[i]
+        );
+    }
+    num_steady = num_allocs[ALLOC_PHASE_STEADY]
+               + num_frees[ALLOC_PHASE_STEADY];
+    if(num_steady) {
+        fprintf(out, "FAILED: the steady state touched the allocator %lu "
+                     "time(s)\n", num_steady);
+    }
+#endif
+
+    return num_steady;
+}
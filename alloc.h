@@ -0,0 +1,40 @@
+/*
+ * alloc.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef ALLOC_H_
+#define ALLOC_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+/* 1 to count every malloc, calloc, realloc, and free by phase; filled in by
+ * the Makefile. */
+#ifndef ALLOC_DEBUG
+#define ALLOC_DEBUG 0
+#endif
+
+#define ALLOC_MAX_POOLS 32
+
+/* What the program is doing when memory is allocated. Only the steady phase
+ * must not allocate; the control phase covers runtime changes such as hiring
+ * an elf, which are expected to. */
+typedef enum {
+    ALLOC_PHASE_SETUP,
+    ALLOC_PHASE_STEADY,
+    ALLOC_PHASE_CONTROL,
+    ALLOC_PHASE_TEARDOWN,
+    ALLOC_NUM_PHASES
+} alloc_phase_t;
+
+void alloc_phase(const alloc_phase_t phase);
+void alloc_thread_phase(const alloc_phase_t phase);
+void *alloc_pool(const char *name, const size_t size);
+void alloc_account(const char *name, const size_t size);
+unsigned long alloc_report(FILE *out);
+
+#endif /* ALLOC_H_ */
@@ -0,0 +1,202 @@
+/*
+ * clock.c
+ *
+ *     Version: $Id$
+ *
+ * Library for timing things within the simulation.
+ *
+ * clock_ns reads CLOCK_MONOTONIC, which goes through the vDSO and so doesn't
+ * make a system call, but still costs a few tens of nanoseconds; too much to
+ * pay twice on every semaphore wait. clock_ticks is for those hot paths: on
+ * x86-64 it reads the time stamp counter with rdtsc, which costs several
+ * times less, and the ticks are only converted to nanoseconds when they are
+ * reported. The counter is only used if it is invariant, i.e. it ticks at a
+ * constant rate whatever the cpu's frequency or sleep state, and if the
+ * kernel itself uses it as its clocksource, which it won't if it found the
+ * counters out of sync between cpus. Otherwise, or until clock_calibrate is
+ * called, a tick is a nanosecond of the monotonic clock.
+ *
+ * rdtsc isn't serializing, so a read can drift by a few dozen instructions
+ * around the code being timed; that's well below what the semaphore waits
+ * and lock holds that are timed with it take.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#include "clock.h"
+
+/* bit of cpuid leaf 0x80000007's edx that says the tsc is invariant. */
+#define CPUID_INVARIANT_TSC (1U << 8)
+
+#define CLOCKSOURCE_PATH \
+    "/sys/devices/system/clocksource/clocksource0/current_clocksource"
+
+static int use_tsc = 0;
+static double ns_per_tick = 1.0;
+static const char *fallback_reason = "not calibrated";
+static double tick_read_ns = 0.0;
+static double ns_read_ns = 0.0;
+static volatile unsigned long read_sink = 0;
+
+/**
+ * Get the current time, in nanoseconds, on a clock that never goes backward.
+ * The clock starts at some arbitrary point, so only differences are useful.
+ */
+unsigned long clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((unsigned long) now.tv_sec) * NS_PER_SEC
+         + (unsigned long) now.tv_nsec;
+}
+
+/**
+ * Read the time stamp counter.
+ */
+static unsigned long read_tsc(void) {
+#if defined(__x86_64__)
+    unsigned int low;
+    unsigned int high;
+    __asm__ __volatile__ ("rdtsc" : "=a" (low), "=d" (high));
+    return ((unsigned long) high << 32) | low;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Get the current time in ticks, which are only useful as differences, and
+ * only once converted to nanoseconds.
+ */
+unsigned long clock_ticks(void) {
+    return use_tsc ? read_tsc() : clock_ns();
+}
+
+/**
+ * Find out why the time stamp counter can't be used.
+ *
+ * Returns: the reason, or NULL if it can be used.
+ */
+static const char *tsc_unsafe(void) {
+#if defined(__x86_64__)
+    unsigned int eax;
+    unsigned int ebx;
+    unsigned int ecx;
+    unsigned int edx;
+    char source[32];
+    FILE *in;
+
+    if(!CLOCK_TSC) {
+        return "turned off at compile time";
+    }
+
+    if(!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)
+    || !(edx & CPUID_INVARIANT_TSC)) {
+        return "no invariant tsc";
+    }
+
+    in = fopen(CLOCKSOURCE_PATH, "r");
+    if(NULL == in) {
+        return "unknown kernel clocksource";
+    }
+    source[0] = '\0';
+    if(NULL == fgets(source, sizeof source, in)) {
+        source[0] = '\0';
+    }
+    fclose(in);
+    if(strncmp(source, "tsc", 3) || ('\n' != source[3] && source[3])) {
+        return "kernel clocksource isn't the tsc";
+    }
+
+    return NULL;
+#else
+    return "no tsc on this architecture";
+#endif
+}
+
+/**
+ * Get how long a clock takes to read, on average.
+ */
+static double time_reads(unsigned long (*read_clock)(void)) {
+    unsigned long start_ns = clock_ns();
+    int i;
+
+    for(i = 0; i < CLOCK_BENCHMARK_READS; ++i) {
+        read_sink = read_clock();
+    }
+    return (double) (clock_ns() - start_ns) / CLOCK_BENCHMARK_READS;
+}
+
+/**
+ * Decide whether ticks come from the time stamp counter and, if they do, find
+ * out how many nanoseconds each one is by watching it for
+ * CLOCK_CALIBRATION_NS against the monotonic clock. Also time how long each
+ * clock takes to read. This should be called once, before anything is timed
+ * in ticks.
+ */
+void clock_calibrate(void) {
+    unsigned long start_ns;
+    unsigned long end_ns;
+    unsigned long start_tsc;
+    unsigned long end_tsc;
+
+    fallback_reason = tsc_unsafe();
+    if(NULL == fallback_reason) {
+        start_ns = clock_ns();
+        start_tsc = read_tsc();
+        do {
+            end_ns = clock_ns();
+        } while(end_ns - start_ns < CLOCK_CALIBRATION_NS);
+        end_tsc = read_tsc();
+
+        if(end_tsc > start_tsc) {
+            ns_per_tick = (double) (end_ns - start_ns)
+                        / (double) (end_tsc - start_tsc);
+            use_tsc = 1;
+        } else {
+            fallback_reason = "tsc went backward";
+        }
+    }
+
+    ns_read_ns = time_reads(&clock_ns);
+    tick_read_ns = time_reads(&clock_ticks);
+}
+
+/**
+ * Get the number of nanoseconds per tick.
+ */
+double clock_ns_per_tick(void) {
+    return ns_per_tick;
+}
+
+/**
+ * Convert a number of ticks, e.g. the difference between two clock_ticks, to
+ * nanoseconds.
+ */
+unsigned long clock_ticks_to_ns(const unsigned long ticks) {
+    return use_tsc ? (unsigned long) ((double) ticks * ns_per_tick) : ticks;
+}
+
+/**
+ * Print out where ticks come from and what each clock costs to read.
+ */
+void clock_describe(FILE *out) {
+    if(use_tsc) {
+        fprintf(out, "clock: ticks from the tsc at %.3f GHz",
+            1.0 / ns_per_tick
+        );
+    } else {
+        fprintf(out, "clock: ticks from the monotonic clock (%s)",
+            fallback_reason
+        );
+    }
+    fprintf(out, ", %.1f ns per tick read, %.1f ns per monotonic read\n",
+        tick_read_ns, ns_read_ns
+    );
+}
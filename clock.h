@@ -0,0 +1,35 @@
+/*
+ * clock.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdio.h>
+
+#define NS_PER_SEC 1000000000UL
+
+/* 1 to read ticks from the time stamp counter where it's safe to; 0 to always
+ * read them from the monotonic clock, as nanoseconds. */
+#ifndef CLOCK_TSC
+#define CLOCK_TSC 1
+#endif
+
+/* how long to calibrate the time stamp counter against the monotonic clock
+ * for, and how many reads of each clock to time when benchmarking them. */
+#define CLOCK_CALIBRATION_NS 10000000UL
+#define CLOCK_BENCHMARK_READS 100000
+
+unsigned long clock_ns(void);
+
+/* a cheaper clock for hot paths, in ticks that are converted to nanoseconds
+ * only when reporting. */
+void clock_calibrate(void);
+unsigned long clock_ticks(void);
+double clock_ns_per_tick(void);
+unsigned long clock_ticks_to_ns(const unsigned long ticks);
+void clock_describe(FILE *out);
+
+#endif /* CLOCK_H_ */
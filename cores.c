@@ -0,0 +1,588 @@
+/*
+ * cores.c
+ *
+ *     Version: $Id$
+ *
+ * The Santa Claus Problem with a thread per core and nothing shared between
+ * the cores. Each core is pinned to its own cpu and owns a disjoint slice of
+ * the elves and reindeer, which it runs to completion one at a time from its
+ * own run queue; the lines that the elves wait in, the reindeer counts, and
+ * the latency histograms are all private to the core.
+ *
+ * Santa lives on a core of his own, and the only way to reach him is through
+ * a pair of single-producer single-consumer queues per core: one to santa and
+ * one back. A core sends santa a whole group of elves once enough of its own
+ * elves are lined up, and tells him once all of its reindeer are back; santa
+ * answers with the group once he has helped it, and with the delivery once
+ * every reindeer is back. Pushing and popping are plain loads and stores with
+ * acquire and release ordering, and each side keeps a private copy of the
+ * other side's index so that it only reads the other side's line when the
+ * copy says the queue is full or empty. Queues are sized so that they never
+ * fill.
+ *
+ * The differences from the threads backend are that groups only ever form
+ * from elves on the same core, like they only form within a region, and that
+ * there are no regional santas, no preemption, and one team of every
+ * reindeer.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "alloc.h"
+#include "hist.h"
+#include "cores.h"
+
+#define CACHE_LINE_SIZE 64
+
+typedef enum {
+    MESSAGE_GROUP,
+    MESSAGE_BACK,
+    MESSAGE_HELPED,
+    MESSAGE_DELIVERED
+} message_type_t;
+
+/* A group of a core's elves, by their index on the core, or, for MESSAGE_BACK,
+ * the number of the core's reindeer that are back. */
+typedef struct {
+    int type;
+    int count;
+    int elves[CORES_MAX_GROUP_SIZE];
+} message_t;
+
+/* A single-producer single-consumer ring of messages. The ring itself is only
+ * read after it is set up; the tail and the producer's copy of the head are
+ * only written by the producer, and the head and the consumer's copy of the
+ * tail are only written by the consumer, so each is on its own line. */
+typedef struct {
+    message_t *messages;
+    unsigned long mask;
+    char padding0[CACHE_LINE_SIZE - sizeof(void *) - sizeof(unsigned long)];
+
+    unsigned long tail;
+    unsigned long cached_head;
+    char padding1[CACHE_LINE_SIZE - 2 * sizeof(unsigned long)];
+
+    unsigned long head;
+    unsigned long cached_tail;
+    char padding2[CACHE_LINE_SIZE - 2 * sizeof(unsigned long)];
+} queue_t;
+
+typedef struct {
+    queue_t to_santa;
+    queue_t from_santa;
+
+    int id;
+    int num_elves;
+    int num_reindeer;
+
+    /* actors that are ready to run, as a ring of their indexes on the core;
+     * elves come first and reindeer follow. Every actor is in the ring at
+     * most once, so sizing it to the actors means it never fills. */
+    int *runnable;
+    int run_head;
+    int num_runnable;
+
+    /* elves that need help but aren't yet in a group. */
+    int line[CORES_MAX_GROUP_SIZE];
+    int line_length;
+    unsigned long *lined_up_ns;
+
+    int num_reindeer_back;
+    unsigned long rng;
+    hist_t latency;
+    unsigned long num_steps;
+    unsigned long num_messages;
+    pthread_t thread;
+
+    char padding[CACHE_LINE_SIZE];
+} core_t;
+
+typedef struct {
+    /* groups waiting for help, as a ring of messages and the cores that they
+     * came from. */
+    message_t *groups;
+    int *group_cores;
+    int group_head;
+    int num_groups;
+    int group_capacity;
+
+    int num_back;
+    unsigned long rng;
+    unsigned long num_groups_helped;
+    unsigned long num_deliveries;
+    unsigned long num_messages;
+    unsigned long num_idle_polls;
+} santa_t;
+
+static const cores_config_t *config = NULL;
+static core_t *cores = NULL;
+static santa_t santa;
+static int should_stop = 0;
+
+/**
+ * Get the next number from a generator.
+ */
+static unsigned long next_random(unsigned long *rng) {
+    unsigned long x = *rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *rng = x;
+    return x * 0x2545f4914f6cdd1dUL;
+}
+
+/**
+ * Get a random amount of work, in cycles, of less than some max.
+ */
+static unsigned int random_amount(unsigned long *rng, const int max_time) {
+    return (unsigned int) ((next_random(rng) >> 16) % (unsigned long) max_time);
+}
+
+/**
+ * Set up a queue that can hold at least some number of messages.
+ */
+static void queue_init(queue_t *queue, const int capacity) {
+    unsigned long size = 1;
+    while(size < (unsigned long) capacity) {
+        size <<= 1;
+    }
+    memset(queue, 0, sizeof *queue);
+    queue->messages = (message_t *) alloc_pool(
+        "core queues", sizeof(message_t) * size
+    );
+    queue->mask = size - 1;
+}
+
+/**
+ * Add a message to a queue. Only the producer may call this.
+ */
+static void queue_push(queue_t *queue, const message_t *message) {
+    const unsigned long tail = queue->tail;
+
+    if(tail - queue->cached_head > queue->mask) {
+        queue->cached_head = __atomic_load_n(&(queue->head), __ATOMIC_ACQUIRE);
+        assert(tail - queue->cached_head <= queue->mask);
+    }
+
+    queue->messages[tail & queue->mask] = *message;
+    __atomic_store_n(&(queue->tail), tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the oldest message off of a queue. Only the consumer may call this.
+ *
+ * Returns: 1 if there was a message, 0 if the queue was empty.
+ */
+static int queue_pop(queue_t *queue, message_t *message) {
+    const unsigned long head = queue->head;
+
+    if(head == queue->cached_tail) {
+        queue->cached_tail = __atomic_load_n(&(queue->tail), __ATOMIC_ACQUIRE);
+        if(head == queue->cached_tail) {
+            return 0;
+        }
+    }
+
+    *message = queue->messages[head & queue->mask];
+    __atomic_store_n(&(queue->head), head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * Pin the calling thread to a cpu.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+static void pin_to_cpu(const int cpu) {
+    const int num_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu % num_cpus, &cpus);
+    if(0 != pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus)) {
+        perror("pin_to_cpu[pthread_setaffinity_np]");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Get the global id of an actor on a core, as passed to the workload.
+ */
+static int global_id(const core_t *core, const int index) {
+    return index * config->num_cores + core->id;
+}
+
+/**
+ * Make an actor on a core ready to run.
+ */
+static void make_runnable(core_t *core, const int index) {
+    const int num_actors = core->num_elves + core->num_reindeer;
+    int slot = core->run_head + core->num_runnable;
+    if(slot >= num_actors) {
+        slot -= num_actors;
+    }
+    core->runnable[slot] = index;
+    ++(core->num_runnable);
+}
+
+/**
+ * Run the next ready actor on a core until it has to wait for santa: an elf
+ * works and then lines up, and a reindeer goes on vacation and then comes
+ * back.
+ */
+static void run_actor(core_t *core) {
+    const int num_actors = core->num_elves + core->num_reindeer;
+    const workload_t *workload = config->workload;
+    const int index = core->runnable[core->run_head];
+    message_t message;
+
+    if(++(core->run_head) == num_actors) {
+        core->run_head = 0;
+    }
+    --(core->num_runnable);
+    ++(core->num_steps);
+
+    if(index < core->num_elves) {
+        if(NULL != workload->work) {
+            workload->work(global_id(core, index),
+                random_amount(&(core->rng), config->max_wait_time)
+            );
+        }
+        core->lined_up_ns[index] = clock_ns();
+        core->line[core->line_length++] = index;
+        if(core->line_length == config->group_size) {
+            message.type = MESSAGE_GROUP;
+            message.count = core->line_length;
+            memcpy(&(message.elves[0]), &(core->line[0]),
+                sizeof(int) * core->line_length
+            );
+            core->line_length = 0;
+            ++(core->num_messages);
+            queue_push(&(core->to_santa), &message);
+        }
+        return;
+    }
+
+    if(NULL != workload->vacation) {
+        workload->vacation(global_id(core, index - core->num_elves),
+            random_amount(&(core->rng), config->max_wait_time)
+        );
+    }
+    if(++(core->num_reindeer_back) == core->num_reindeer) {
+        message.type = MESSAGE_BACK;
+        message.count = core->num_reindeer;
+        core->num_reindeer_back = 0;
+        ++(core->num_messages);
+        queue_push(&(core->to_santa), &message);
+    }
+}
+
+/**
+ * Handle everything that santa has sent a core.
+ *
+ * Returns: 1 if there were any messages, 0 otherwise.
+ */
+static int core_receive(core_t *core) {
+    message_t message;
+    unsigned long now_ns;
+    int received = 0;
+    int i;
+
+    while(queue_pop(&(core->from_santa), &message)) {
+        received = 1;
+        if(MESSAGE_HELPED == message.type) {
+            now_ns = clock_ns();
+            for(i = 0; i < message.count; ++i) {
+                hist_add(&(core->latency),
+                    now_ns - core->lined_up_ns[message.elves[i]]
+                );
+                make_runnable(core, message.elves[i]);
+            }
+        } else {
+            for(i = 0; i < core->num_reindeer; ++i) {
+                make_runnable(core, core->num_elves + i);
+            }
+        }
+    }
+    return received;
+}
+
+/**
+ * Core thread: run the core's actors, a batch at a time, until santa says to
+ * stop. A core with nothing to do yields its cpu rather than spin, which only
+ * matters when there are more cores than cpus.
+ */
+static void *core_thread(void *arg) {
+    core_t *core = (core_t *) arg;
+    int made_progress;
+    int i;
+
+    pin_to_cpu(1 + core->id);
+    alloc_thread_phase(ALLOC_PHASE_STEADY);
+
+    while(!__atomic_load_n(&should_stop, __ATOMIC_RELAXED)) {
+        made_progress = core_receive(core);
+        for(i = 0; i < CORES_BATCH && core->num_runnable; ++i) {
+            run_actor(core);
+            made_progress = 1;
+        }
+        if(!made_progress) {
+            sched_yield();
+        }
+    }
+
+    alloc_thread_phase(ALLOC_PHASE_TEARDOWN);
+    return NULL;
+}
+
+/**
+ * Handle everything that the cores have sent santa.
+ *
+ * Returns: 1 if there were any messages, 0 otherwise.
+ */
+static int santa_receive(void) {
+    message_t message;
+    int received = 0;
+    int slot;
+    int i;
+
+    for(i = 0; i < config->num_cores; ++i) {
+        while(queue_pop(&(cores[i].to_santa), &message)) {
+            received = 1;
+            if(MESSAGE_BACK == message.type) {
+                santa.num_back += message.count;
+                continue;
+            }
+            slot = santa.group_head + santa.num_groups;
+            if(slot >= santa.group_capacity) {
+                slot -= santa.group_capacity;
+            }
+            assert(santa.num_groups < santa.group_capacity);
+            santa.groups[slot] = message;
+            santa.group_cores[slot] = i;
+            ++(santa.num_groups);
+        }
+    }
+    return received;
+}
+
+/**
+ * Help the oldest waiting group of elves and send it back to its core.
+ */
+static void santa_help(void) {
+    const workload_t *workload = config->workload;
+    message_t *group = &(santa.groups[santa.group_head]);
+    core_t *core = &(cores[santa.group_cores[santa.group_head]]);
+    int i;
+
+    if(NULL != workload->help) {
+        for(i = 0; i < group->count; ++i) {
+            workload->help(global_id(core, group->elves[i]),
+                random_amount(&(santa.rng), config->max_help_time)
+            );
+        }
+    }
+
+    group->type = MESSAGE_HELPED;
+    ++(santa.num_messages);
+    queue_push(&(core->from_santa), group);
+
+    if(++(santa.group_head) == santa.group_capacity) {
+        santa.group_head = 0;
+    }
+    --(santa.num_groups);
+    ++(santa.num_groups_helped);
+}
+
+/**
+ * Santa's core: deliver presents whenever every reindeer is back, and
+ * otherwise help groups of elves in the order that they arrived, until the
+ * run is over.
+ */
+static void run_santa(void) {
+    const unsigned long start_ns = clock_ns();
+    message_t message;
+    int received;
+    int i;
+
+    pin_to_cpu(0);
+
+    while(santa.num_deliveries < (unsigned long) config->max_deliveries
+       && (!config->duration_ns
+           || clock_ns() - start_ns < config->duration_ns)) {
+
+        received = santa_receive();
+
+        if(santa.num_back == config->num_reindeer) {
+            santa.num_back = 0;
+            ++(santa.num_deliveries);
+            message.type = MESSAGE_DELIVERED;
+            message.count = 0;
+            for(i = 0; i < config->num_cores; ++i) {
+                if(cores[i].num_reindeer) {
+                    ++(santa.num_messages);
+                    queue_push(&(cores[i].from_santa), &message);
+                }
+            }
+        } else if(santa.num_groups) {
+            santa_help();
+        } else if(!received) {
+            ++(santa.num_idle_polls);
+            sched_yield();
+        }
+    }
+
+    __atomic_store_n(&should_stop, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Deal the actors out to the cores and set up everything that they own.
+ */
+static void init_cores(void) {
+    const int num_cores = config->num_cores;
+    core_t *core;
+    int num_groups;
+    int i;
+    int j;
+
+    cores = (core_t *) alloc_pool("cores", sizeof(core_t) * num_cores);
+    memset(&santa, 0, sizeof santa);
+
+    for(i = 0; i < num_cores; ++i) {
+        core = &(cores[i]);
+        core->id = i;
+        core->num_elves = (config->num_elves - i + num_cores - 1) / num_cores;
+        core->num_reindeer =
+            (config->num_reindeer - i + num_cores - 1) / num_cores;
+        core->rng = config->seed
+                  + 0x9e3779b97f4a7c15UL * (unsigned long) (i + 1);
+        if(!core->rng) {
+            core->rng = 1;
+        }
+
+        /* a core never has more than every one of its groups out at once,
+         * plus its reindeer. */
+        num_groups = core->num_elves / config->group_size;
+        queue_init(&(core->to_santa), num_groups + 1);
+        queue_init(&(core->from_santa), num_groups + 1);
+        santa.group_capacity += num_groups;
+
+        core->runnable = (int *) alloc_pool(
+            "core actors", sizeof(int) * (core->num_elves + core->num_reindeer)
+        );
+        core->lined_up_ns = (unsigned long *) alloc_pool(
+            "core actors", sizeof(unsigned long) * core->num_elves
+        );
+        hist_clear(&(core->latency));
+
+        for(j = 0; j < core->num_elves + core->num_reindeer; ++j) {
+            make_runnable(core, j);
+        }
+    }
+
+    santa.groups = (message_t *) alloc_pool(
+        "santa's groups", sizeof(message_t) * santa.group_capacity
+    );
+    santa.group_cores = (int *) alloc_pool(
+        "santa's groups", sizeof(int) * santa.group_capacity
+    );
+    santa.rng = ~config->seed ? ~config->seed : 1;
+}
+
+/**
+ * Fill in the default configuration.
+ */
+void cores_config_init(cores_config_t *config) {
+    assert(NULL != config);
+    config->num_elves = 9;
+    config->num_reindeer = 9;
+    config->group_size = 3;
+    config->num_cores = 1;
+    config->max_wait_time = 1 << 16;
+    config->max_help_time = 1 << 13;
+    config->duration_ns = 0;
+    config->max_deliveries = 1;
+    config->seed = 0;
+    config->workload = NULL;
+}
+
+/**
+ * Run the simulation and report what santa did and how long elves waited.
+ *
+ * Returns: the process exit status.
+ */
+int cores_simulate(const cores_config_t *cores_config) {
+    static hist_t elf_latency;
+    unsigned long start_ns;
+    unsigned long elapsed_ns;
+    unsigned long num_steps = 0;
+    unsigned long num_messages;
+    int i;
+
+    assert(NULL != cores_config);
+    assert(NULL != cores_config->workload);
+
+    if(0 >= cores_config->group_size
+    || CORES_MAX_GROUP_SIZE < cores_config->group_size
+    || 0 >= cores_config->num_cores
+    || CORES_MAX_CORES < cores_config->num_cores
+    || cores_config->num_elves
+       < cores_config->group_size * cores_config->num_cores
+    || 0 >= cores_config->num_reindeer
+    || 0 >= cores_config->max_wait_time
+    || 0 >= cores_config->max_help_time
+    || 0 >= cores_config->max_deliveries) {
+        fprintf(stderr, "Groups of 1 to %d elves, 1 to %d cores with at least "
+                        "a group of elves each, one reindeer, and positive "
+                        "wait times are supported.\n",
+            CORES_MAX_GROUP_SIZE, CORES_MAX_CORES
+        );
+        return EXIT_FAILURE;
+    }
+
+    config = cores_config;
+    init_cores();
+    hist_clear(&elf_latency);
+
+    start_ns = clock_ns();
+    for(i = 0; i < config->num_cores; ++i) {
+        if(0 != pthread_create(&(cores[i].thread), NULL,
+                               &core_thread, &(cores[i]))) {
+            perror("cores_simulate[pthread_create]");
+            exit(EXIT_FAILURE);
+        }
+    }
+    run_santa();
+    for(i = 0; i < config->num_cores; ++i) {
+        pthread_join(cores[i].thread, NULL);
+    }
+    elapsed_ns = clock_ns() - start_ns;
+
+    num_messages = santa.num_messages;
+    for(i = 0; i < config->num_cores; ++i) {
+        num_steps += cores[i].num_steps;
+        num_messages += cores[i].num_messages;
+        hist_merge(&elf_latency, &(cores[i].latency));
+    }
+
+    fprintf(stdout,
+        "\n%d elves and %d reindeer on %d cores plus santa's, over %.3fs:\n"
+        "    %lu elf groups helped, %.2f groups/s, %lu deliveries\n"
+        "    %lu actor steps, %lu messages, %lu idle polls by santa\n",
+        config->num_elves, config->num_reindeer, config->num_cores,
+        (double) elapsed_ns / NS_PER_SEC,
+        santa.num_groups_helped,
+        (double) santa.num_groups_helped * NS_PER_SEC
+            / (elapsed_ns ? elapsed_ns : 1),
+        santa.num_deliveries, num_steps, num_messages, santa.num_idle_polls
+    );
+    hist_print(&elf_latency, "elf help", 1.0, stdout);
+
+    return EXIT_SUCCESS;
+}
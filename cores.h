@@ -0,0 +1,47 @@
+/*
+ * cores.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef CORES_H_
+#define CORES_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+#include "workload.h"
+
+#define CORES_MAX_CORES 256
+#define CORES_MAX_GROUP_SIZE 16
+
+/* how many actors a core runs between looking for messages from santa. */
+#define CORES_BATCH 16
+
+typedef struct {
+    int num_elves;
+    int num_reindeer;
+    int group_size;
+
+    /* cores that run elves and reindeer; santa gets one more. */
+    int num_cores;
+
+    /* max amounts of work per wait, in cycles; see workload.h. */
+    int max_wait_time;
+    int max_help_time;
+
+    /* the run ends after this long, or after this many deliveries, whichever
+     * comes first; a duration of 0 means no time limit. */
+    unsigned long duration_ns;
+    int max_deliveries;
+
+    unsigned long seed;
+
+    const workload_t *workload;
+} cores_config_t;
+
+void cores_config_init(cores_config_t *config);
+int cores_simulate(const cores_config_t *config);
+
+#endif /* CORES_H_ */
@@ -0,0 +1,407 @@
+/*
+ * coro.c
+ *
+ *     Version: $Id$
+ *
+ * Library for running huge numbers of stackless coroutines on a handful of
+ * executor threads, usually one per core. A coroutine that waits on a
+ * semaphore, group, or barrier doesn't hold onto a thread; it's put on the
+ * waiting list of whatever it's waiting on and later handed back to its own
+ * executor's ready queue. Executors take their whole ready queue at once and
+ * resume everything in it as a batch, so a wakeup is just a function call.
+ */
+
+#include "coro.h"
+
+/* upper bound on the number of executor threads. */
+#define MAX_EXECUTORS 64
+
+/**
+ * An executor thread and the queue of coroutines that are ready to run on it.
+ */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    coro_t *head;
+    coro_t *tail;
+    unsigned long num_resumes;
+} executor_t;
+
+static executor_t executors[MAX_EXECUTORS];
+static int is_initialized = 0;
+static volatile int is_running = 0;
+
+/**
+ * Initialize the executors, if not already done.
+ */
+static void init_executors(void) {
+    int i;
+    if(is_initialized) {
+        return;
+    }
+
+    for(i = 0; i < MAX_EXECUTORS; ++i) {
+        pthread_mutex_init(&(executors[i].lock), NULL);
+        pthread_cond_init(&(executors[i].ready), NULL);
+        executors[i].head = NULL;
+        executors[i].tail = NULL;
+        executors[i].num_resumes = 0;
+    }
+
+    is_initialized = 1;
+}
+
+/**
+ * Append a coroutine to the end of an intrusive coroutine list.
+ */
+static void list_append(coro_t **head, coro_t **tail, coro_t *coro) {
+    coro->next = NULL;
+    if(NULL == *head) {
+        *head = coro;
+    } else {
+        (*tail)->next = coro;
+    }
+    *tail = coro;
+}
+
+/**
+ * Start a coroutine. It will first be resumed on the given executor, and all
+ * later wakeups will also go to that executor.
+ *
+ * Params: - Pointer to the coroutine; this must outlive the coroutine.
+ *         - The step function that runs the coroutine up to its next
+ *           suspension point.
+ *         - Index of the executor that owns the coroutine; it's taken modulo
+ *           the maximum number of executors.
+ */
+void coro_start(coro_t *coro, coro_fn_t step, const int executor) {
+    assert(NULL != coro);
+    assert(NULL != step);
+
+    init_executors();
+
+    coro->step = step;
+    coro->next = NULL;
+    coro->resume_point = 0;
+    coro->executor = executor % MAX_EXECUTORS;
+
+    coro_schedule(coro);
+}
+
+/**
+ * Put a coroutine on its executor's ready queue.
+ */
+void coro_schedule(coro_t *coro) {
+    executor_t *executor;
+    int was_idle;
+
+    assert(NULL != coro);
+    executor = &(executors[coro->executor]);
+
+    pthread_mutex_lock(&(executor->lock));
+    was_idle = (NULL == executor->head);
+    list_append(&(executor->head), &(executor->tail), coro);
+    pthread_mutex_unlock(&(executor->lock));
+
+    if(was_idle) {
+        pthread_cond_signal(&(executor->ready));
+    }
+}
+
+/**
+ * An executor thread. Repeatedly take the entire ready queue and resume every
+ * coroutine in it.
+ */
+static void *executor_loop(void *executor_ptr) {
+    executor_t *executor = (executor_t *) executor_ptr;
+    coro_t *batch;
+    coro_t *coro;
+
+    while(is_running) {
+        pthread_mutex_lock(&(executor->lock));
+        while(is_running && NULL == executor->head) {
+            pthread_cond_wait(&(executor->ready), &(executor->lock));
+        }
+        batch = executor->head;
+        executor->head = NULL;
+        executor->tail = NULL;
+        pthread_mutex_unlock(&(executor->lock));
+
+        while(is_running && NULL != batch) {
+            coro = batch;
+            batch = batch->next;
+            coro->next = NULL;
+            coro->step(coro);
+            ++(executor->num_resumes);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Run all started coroutines on some number of executor threads. Coroutines
+ * owned by executors at or above num_threads are folded onto the others.
+ * Returns once coro_stop has been called.
+ */
+void coro_run(const int num_threads) {
+    int i;
+    int j;
+    coro_t *coro;
+
+    assert(0 < num_threads && num_threads <= MAX_EXECUTORS);
+    init_executors();
+
+    /* fold the extra executors' queues onto the ones that will run. */
+    for(i = num_threads; i < MAX_EXECUTORS; ++i) {
+        for(coro = executors[i].head; NULL != coro; coro = executors[i].head) {
+            executors[i].head = coro->next;
+            j = i % num_threads;
+            coro->executor = j;
+            list_append(&(executors[j].head), &(executors[j].tail), coro);
+        }
+        executors[i].tail = NULL;
+    }
+
+    is_running = 1;
+    for(i = 0; i < num_threads; ++i) {
+        pthread_create(
+            &(executors[i].thread), NULL, &executor_loop, &(executors[i])
+        );
+    }
+
+    for(i = 0; i < num_threads; ++i) {
+        pthread_join(executors[i].thread, NULL);
+    }
+}
+
+/**
+ * Stop all executors. Coroutines that are in the middle of running finish
+ * their current step; nothing else is resumed.
+ */
+void coro_stop(void) {
+    int i;
+    is_running = 0;
+    for(i = 0; i < MAX_EXECUTORS; ++i) {
+        pthread_mutex_lock(&(executors[i].lock));
+        pthread_cond_broadcast(&(executors[i].ready));
+        pthread_mutex_unlock(&(executors[i].lock));
+    }
+}
+
+/**
+ * Get the total number of coroutine resumes across all executors. Only
+ * meaningful once the executors have stopped.
+ */
+unsigned long coro_num_resumes(void) {
+    unsigned long total = 0;
+    int i;
+    for(i = 0; i < MAX_EXECUTORS; ++i) {
+        total += executors[i].num_resumes;
+    }
+    return total;
+}
+
+/**
+ * Initialize a coroutine semaphore to some value.
+ */
+void coro_sem_init(coro_sem_t *sem, const int value) {
+    assert(NULL != sem);
+    assert(0 <= value);
+    pthread_mutex_init(&(sem->lock), NULL);
+    sem->value = value;
+    sem->head = NULL;
+    sem->tail = NULL;
+}
+
+/**
+ * Wait on a semaphore. If the semaphore can't be decremented right away then
+ * the coroutine is queued up on the semaphore and will be rescheduled once it
+ * has been signalled on the coroutine's behalf.
+ *
+ * Returns: 1 if the coroutine can continue, 0 if it must suspend.
+ */
+int coro_sem_wait(coro_sem_t *sem, coro_t *coro) {
+    int acquired = 0;
+
+    assert(NULL != sem);
+    assert(NULL != coro);
+
+    pthread_mutex_lock(&(sem->lock));
+    if(0 < sem->value) {
+        --(sem->value);
+        acquired = 1;
+    } else {
+        list_append(&(sem->head), &(sem->tail), coro);
+    }
+    pthread_mutex_unlock(&(sem->lock));
+
+    return acquired;
+}
+
+/**
+ * Signal a semaphore num_signals times. Each signal goes directly to a waiting
+ * coroutine, in FIFO order, if there is one.
+ */
+void coro_sem_signal(coro_sem_t *sem, const int num_signals) {
+    coro_t *woken = NULL;
+    coro_t *woken_tail = NULL;
+    coro_t *coro;
+    int i;
+
+    assert(NULL != sem);
+    assert(0 < num_signals);
+
+    pthread_mutex_lock(&(sem->lock));
+    for(i = 0; i < num_signals; ++i) {
+        if(NULL == sem->head) {
+            ++(sem->value);
+            continue;
+        }
+        coro = sem->head;
+        sem->head = coro->next;
+        list_append(&woken, &woken_tail, coro);
+    }
+    if(NULL == sem->head) {
+        sem->tail = NULL;
+    }
+    pthread_mutex_unlock(&(sem->lock));
+
+    /* schedule outside of the lock. */
+    for(coro = woken; NULL != coro; coro = woken) {
+        woken = coro->next;
+        coro_schedule(coro);
+    }
+}
+
+/**
+ * Initialize a group that gathers up to size members.
+ *
+ * Params: - The group to initialize.
+ *         - The number of members that make the group full.
+ *         - Semaphore to signal when the group becomes full, or NULL.
+ */
+void coro_group_init(coro_group_t *group,
+                     const int size,
+                     coro_sem_t *on_full) {
+    assert(NULL != group);
+    assert(0 < size);
+    pthread_mutex_init(&(group->lock), NULL);
+    group->size = size;
+    group->count = 0;
+    group->members = NULL;
+    group->on_full = on_full;
+}
+
+/**
+ * Join a group. The coroutine always suspends; it stays in the group until it
+ * is taken out of the group and rescheduled by someone else. If this fills
+ * the group then the group's on_full semaphore is signalled.
+ *
+ * Params: - The group to join; this must not already be full.
+ *         - The joining coroutine.
+ *
+ * Returns: 0, i.e. the coroutine must suspend.
+ */
+int coro_group_join(coro_group_t *group, coro_t *coro) {
+    int is_full;
+
+    assert(NULL != group);
+    assert(NULL != coro);
+
+    pthread_mutex_lock(&(group->lock));
+    assert(group->count < group->size);
+    coro->next = group->members;
+    group->members = coro;
+    is_full = (++(group->count) == group->size);
+    pthread_mutex_unlock(&(group->lock));
+
+    if(is_full && NULL != group->on_full) {
+        coro_sem_signal(group->on_full, 1);
+    }
+
+    return 0;
+}
+
+/**
+ * Take up to max members out of a group. The members are not rescheduled;
+ * the caller is expected to deal with them and then call coro_schedule.
+ *
+ * Returns: the number of members taken.
+ */
+int coro_group_take(coro_group_t *group, coro_t **members, const int max) {
+    int num_taken = 0;
+
+    assert(NULL != group);
+    assert(NULL != members);
+
+    pthread_mutex_lock(&(group->lock));
+    for(; num_taken < max && NULL != group->members; ++num_taken) {
+        members[num_taken] = group->members;
+        group->members = group->members->next;
+        members[num_taken]->next = NULL;
+    }
+    group->count -= num_taken;
+    pthread_mutex_unlock(&(group->lock));
+
+    return num_taken;
+}
+
+/**
+ * Get the number of members in a group.
+ */
+int coro_group_count(coro_group_t *group) {
+    int count;
+    pthread_mutex_lock(&(group->lock));
+    count = group->count;
+    pthread_mutex_unlock(&(group->lock));
+    return count;
+}
+
+/**
+ * Initialize a barrier for some number of coroutines.
+ */
+void coro_barrier_init(coro_barrier_t *barrier, const int size) {
+    assert(NULL != barrier);
+    coro_group_init(&(barrier->group), size, NULL);
+}
+
+/**
+ * Wait on a barrier. The last coroutine to arrive doesn't suspend, instead it
+ * reschedules all of the others and the barrier is reset for reuse.
+ *
+ * Returns: 1 if the coroutine can continue, 0 if it must suspend.
+ */
+int coro_barrier_wait(coro_barrier_t *barrier, coro_t *coro, int *is_last) {
+    coro_group_t *group;
+    coro_t *members;
+    coro_t *member;
+
+    assert(NULL != barrier);
+    assert(NULL != coro);
+    assert(NULL != is_last);
+
+    group = &(barrier->group);
+
+    pthread_mutex_lock(&(group->lock));
+    *is_last = (group->count + 1 == group->size);
+    if(*is_last) {
+        members = group->members;
+        group->members = NULL;
+        group->count = 0;
+    } else {
+        members = NULL;
+        coro->next = group->members;
+        group->members = coro;
+        ++(group->count);
+    }
+    pthread_mutex_unlock(&(group->lock));
+
+    for(member = members; NULL != member; member = members) {
+        members = member->next;
+        coro_schedule(member);
+    }
+
+    return *is_last;
+}
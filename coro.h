@@ -0,0 +1,105 @@
+/*
+ * coro.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef CORO_H_
+#define CORO_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "assert.h"
+
+/* values returned by a coroutine's step function */
+#define CORO_SUSPENDED 0
+#define CORO_DONE 1
+
+typedef struct coro coro_t;
+typedef int (*coro_fn_t)(coro_t *);
+
+/* A stackless coroutine. Anything that needs to survive a suspension must be
+ * stored in the structure embedding the coroutine, not in locals. */
+struct coro {
+    coro_fn_t step;
+    coro_t *next;
+    int resume_point;
+    int executor;
+};
+
+/* A counting semaphore whose waiters are suspended coroutines. */
+typedef struct {
+    pthread_mutex_t lock;
+    int value;
+    coro_t *head;
+    coro_t *tail;
+} coro_sem_t;
+
+/* A group of coroutines that gathers up to a fixed number of members, which
+ * then stay suspended until someone else takes and reschedules them. The last
+ * member to join signals on_full, if there is one. */
+typedef struct {
+    pthread_mutex_t lock;
+    int size;
+    int count;
+    coro_t *members;
+    coro_sem_t *on_full;
+} coro_group_t;
+
+/* A reusable barrier; the last coroutine to arrive releases the others. */
+typedef struct {
+    coro_group_t group;
+} coro_barrier_t;
+
+/* executors */
+void coro_start(coro_t *coro, coro_fn_t step, const int executor);
+void coro_run(const int num_executors);
+void coro_stop(void);
+void coro_schedule(coro_t *coro);
+unsigned long coro_num_resumes(void);
+
+/* awaitables; these return 1 if the coroutine can continue right away. */
+void coro_sem_init(coro_sem_t *sem, const int value);
+int coro_sem_wait(coro_sem_t *sem, coro_t *coro);
+void coro_sem_signal(coro_sem_t *sem, const int num_signals);
+
+void coro_group_init(coro_group_t *group,
+                     const int size,
+                     coro_sem_t *on_full);
+int coro_group_join(coro_group_t *group, coro_t *coro);
+int coro_group_take(coro_group_t *group, coro_t **members, const int max);
+int coro_group_count(coro_group_t *group);
+
+void coro_barrier_init(coro_barrier_t *barrier, const int size);
+int coro_barrier_wait(coro_barrier_t *barrier, coro_t *coro, int *is_last);
+
+/* Duff's device based control flow for coroutine step functions; this is
+ * what lets santa, the elves, and the reindeer read like straight-line
+ * loops. These can't be used inside of a switch statement within the step
+ * function, and there can be at most one per line. */
+#define CORO_BEGIN(c) switch((c)->resume_point) { case 0:
+
+#define CORO_END(c) } (c)->resume_point = -1; return CORO_DONE;
+
+#define CORO_SUSPEND_UNLESS(c, cond) \
+    (c)->resume_point = __LINE__; \
+    if(!(cond)) { return CORO_SUSPENDED; } \
+    case __LINE__:
+
+#define CORO_YIELD(c) \
+    (c)->resume_point = __LINE__; \
+    coro_schedule(c); \
+    return CORO_SUSPENDED; \
+    case __LINE__:
+
+#define CORO_AWAIT_SEM(c, sem) CORO_SUSPEND_UNLESS(c, coro_sem_wait((sem), (c)))
+
+#define CORO_AWAIT_GROUP(c, group) \
+    CORO_SUSPEND_UNLESS(c, coro_group_join((group), (c)))
+
+#define CORO_AWAIT_BARRIER(c, barrier, is_last) \
+    CORO_SUSPEND_UNLESS(c, coro_barrier_wait((barrier), (c), (is_last)))
+
+#endif /* CORO_H_ */
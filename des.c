@@ -0,0 +1,656 @@
+/*
+ * des.c
+ *
+ *     Version: $Id$
+ *
+ * The Santa Claus Problem as a discrete-event simulation in virtual time,
+ * for populations far too big for a thread, or even a coroutine, per actor.
+ *
+ * The simulation is split into logical processes. The elves and reindeer are
+ * dealt out round-robin to partitions, each of which keeps its own event
+ * queue. Santa is one more logical process that every partition shares; the
+ * only messages are actors arriving at santa's door, and santa releasing them
+ * once he has helped them or delivered the presents.
+ *
+ * Every message is sent at least a lookahead ahead of the time at which it is
+ * sent: an actor knows when it will arrive at santa's door as soon as it
+ * starts its last step, and santa knows when he will release a group as soon
+ * as he starts helping it. So, conservatively, all of the logical processes
+ * can run the window [T, T + lookahead) in parallel without hearing from each
+ * other, where T is the earliest pending event anywhere. Between windows,
+ * everyone waits on a barrier, the messages are handed over, and the next T
+ * is found; windows with nothing in them are skipped over.
+ *
+ * The sequential engine runs the same logical processes one event time at a
+ * time, handing messages over immediately. Each actor has its own random
+ * number generator, and santa breaks ties between arrivals by actor, so what
+ * santa decides, and when, depends only on the seed. Every decision is folded
+ * into a checksum, which is the same no matter the engine or the number of
+ * partitions.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "alloc.h"
+#include "des.h"
+
+#define FNV_OFFSET_BASIS 14695981039346656037UL
+#define FNV_PRIME 1099511628211UL
+
+#define NEVER ULONG_MAX
+
+/* An actor, by its global id, becoming active at some time. Elves are ids 0
+ * to num_elves - 1, and reindeer follow. */
+typedef struct {
+    unsigned long time;
+    int actor;
+} des_event_t;
+
+/* A binary min-heap of events ordered by time, and then by actor. Each actor
+ * has at most one event pending anywhere, so sizing a heap to its actors
+ * means it never fills. */
+typedef struct {
+    des_event_t *events;
+    int size;
+} des_heap_t;
+
+typedef struct {
+    des_heap_t pending;
+
+    /* per actor in the partition, indexed by global id / num_partitions. */
+    unsigned long *rngs;
+    int *steps_left;
+
+    /* arrivals at santa's door made during the current window, and releases
+     * from santa made during the current window. */
+    des_event_t *arrivals;
+    int num_arrivals;
+    des_event_t *releases;
+    int num_releases;
+
+    unsigned long next_time;
+    unsigned long num_events;
+    pthread_t thread;
+
+    char padding[64];
+} partition_t;
+
+typedef struct {
+    des_heap_t arrivals;
+
+    /* elves waiting for help, as a ring of their ids. */
+    int *line;
+    int line_head;
+    int line_length;
+
+    int num_back;
+    int is_busy;
+    unsigned long busy_until;
+    unsigned long rng;
+
+    unsigned long next_time;
+    unsigned long num_events;
+    unsigned long num_groups_helped;
+    unsigned long num_deliveries;
+    unsigned long checksum;
+} santa_lp_t;
+
+static const des_config_t *config = NULL;
+static partition_t *partitions = NULL;
+static int num_partitions = 1;
+static int is_parallel = 0;
+static santa_lp_t santa;
+static unsigned long lookahead = 1;
+static unsigned long num_windows = 0;
+static pthread_barrier_t window_barrier;
+
+/**
+ * Get the next number from a generator.
+ */
+static unsigned long next_random(unsigned long *rng) {
+    unsigned long x = *rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *rng = x;
+    return x * 0x2545f4914f6cdd1dUL;
+}
+
+/**
+ * Seed a generator for some actor; santa is actor -1.
+ */
+static unsigned long seed_random(const int actor) {
+    unsigned long x = config->seed
+                    + 0x9e3779b97f4a7c15UL * (unsigned long) (actor + 2);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    x ^= x >> 31;
+    return x ? x : 1;
+}
+
+/**
+ * Get a random delay in [min, max].
+ */
+static unsigned long random_delay(unsigned long *rng,
+                                  const unsigned long min,
+                                  const unsigned long max) {
+    return min + next_random(rng) % (max - min + 1);
+}
+
+/**
+ * Order events by time, and then by actor.
+ */
+static int event_before(const des_event_t *a, const des_event_t *b) {
+    return a->time < b->time || (a->time == b->time && a->actor < b->actor);
+}
+
+static void heap_push(des_heap_t *heap, const des_event_t event) {
+    int i = heap->size++;
+    int parent;
+    while(0 < i) {
+        parent = (i - 1) / 2;
+        if(!event_before(&event, &(heap->events[parent]))) {
+            break;
+        }
+        heap->events[i] = heap->events[parent];
+        i = parent;
+    }
+    heap->events[i] = event;
+}
+
+static des_event_t heap_pop(des_heap_t *heap) {
+    des_event_t top = heap->events[0];
+    des_event_t last = heap->events[--heap->size];
+    int i = 0;
+    int child;
+
+    while((child = 2 * i + 1) < heap->size) {
+        if(child + 1 < heap->size
+        && event_before(&(heap->events[child + 1]), &(heap->events[child]))) {
+            ++child;
+        }
+        if(!event_before(&(heap->events[child]), &last)) {
+            break;
+        }
+        heap->events[i] = heap->events[child];
+        i = child;
+    }
+    heap->events[i] = last;
+    return top;
+}
+
+static unsigned long heap_next_time(const des_heap_t *heap) {
+    return heap->size ? heap->events[0].time : NEVER;
+}
+
+static partition_t *partition_of(const int actor) {
+    return &(partitions[actor % num_partitions]);
+}
+
+/**
+ * Have santa release an actor at some time.
+ */
+static void send_release(const int actor, const unsigned long time) {
+    partition_t *partition = partition_of(actor);
+    des_event_t event;
+    event.time = time;
+    event.actor = actor;
+    if(is_parallel) {
+        partition->releases[partition->num_releases++] = event;
+    } else {
+        heap_push(&(partition->pending), event);
+    }
+}
+
+/**
+ * Have an actor arrive at santa's door at some time.
+ */
+static void send_arrival(partition_t *partition, const des_event_t event) {
+    if(is_parallel) {
+        partition->arrivals[partition->num_arrivals++] = event;
+    } else {
+        heap_push(&(santa.arrivals), event);
+    }
+}
+
+/**
+ * Fold a word of one of santa's decisions into the checksum.
+ */
+static void record(const unsigned long word) {
+    santa.checksum = (santa.checksum ^ word) * FNV_PRIME;
+}
+
+/**
+ * Santa is free at some time; deliver the presents if every reindeer is
+ * back, or else help a group of elves if there is one.
+ */
+static void santa_decide(const unsigned long now) {
+    const int num_elves = config->num_elves;
+    unsigned long duration;
+    int elf;
+    int i;
+
+    if(santa.num_back == config->num_reindeer) {
+        duration = random_delay(
+            &(santa.rng), config->min_delivery, config->max_delivery
+        );
+        santa.is_busy = 1;
+        santa.busy_until = now + duration;
+        santa.num_back = 0;
+        ++(santa.num_deliveries);
+        record(now);
+        record(duration);
+        for(i = 0; i < config->num_reindeer; ++i) {
+            send_release(num_elves + i, santa.busy_until);
+        }
+
+    } else if(santa.line_length >= config->group_size) {
+        duration = random_delay(
+            &(santa.rng), config->min_help, config->max_help
+        );
+        santa.is_busy = 1;
+        santa.busy_until = now + duration;
+        ++(santa.num_groups_helped);
+        record(now);
+        for(i = 0; i < config->group_size; ++i) {
+            elf = santa.line[santa.line_head];
+            santa.line_head = (santa.line_head + 1) % num_elves;
+            --(santa.line_length);
+            if(NULL != config->workload->help) {
+                config->workload->help(elf, (unsigned int) duration);
+            }
+            record((unsigned long) elf);
+            send_release(elf, santa.busy_until);
+        }
+    }
+}
+
+static unsigned long santa_next_time(void) {
+    unsigned long next = heap_next_time(&(santa.arrivals));
+    if(santa.is_busy && santa.busy_until < next) {
+        next = santa.busy_until;
+    }
+    return next;
+}
+
+/**
+ * Run santa until some time. Everyone who arrives at a time is let in before
+ * santa decides what to do at that time.
+ */
+static void santa_advance(const unsigned long until) {
+    unsigned long now;
+    des_event_t event;
+
+    while((now = santa_next_time()) < until) {
+        if(santa.is_busy && santa.busy_until == now) {
+            santa.is_busy = 0;
+        }
+
+        while(heap_next_time(&(santa.arrivals)) == now) {
+            event = heap_pop(&(santa.arrivals));
+            ++(santa.num_events);
+            if(event.actor >= config->num_elves) {
+                ++(santa.num_back);
+            } else {
+                santa.line[
+                    (santa.line_head + santa.line_length) % config->num_elves
+                ] = event.actor;
+                ++(santa.line_length);
+            }
+        }
+
+        if(!santa.is_busy) {
+            santa_decide(now);
+        }
+    }
+}
+
+/**
+ * Have an actor take one step: an elf works on a toy, and a reindeer takes
+ * its whole vacation. If that's the actor's last step, then it will be at
+ * santa's door once the step is done.
+ */
+static void actor_step(partition_t *partition, des_event_t event) {
+    const int local = event.actor / num_partitions;
+    unsigned long *rng = &(partition->rngs[local]);
+    int *steps_left = &(partition->steps_left[local]);
+    unsigned long duration;
+    int id;
+
+    ++(partition->num_events);
+
+    if(event.actor < config->num_elves) {
+        id = event.actor;
+        if(!*steps_left) {
+            *steps_left = 1 + (int) (next_random(rng) % config->max_steps);
+        }
+        duration = random_delay(rng, config->min_step, config->max_step);
+        if(NULL != config->workload->work) {
+            config->workload->work(id, (unsigned int) duration);
+        }
+    } else {
+        id = event.actor - config->num_elves;
+        *steps_left = 1;
+        duration = random_delay(
+            rng, config->min_vacation, config->max_vacation
+        );
+        if(NULL != config->workload->vacation) {
+            config->workload->vacation(id, (unsigned int) duration);
+        }
+    }
+
+    event.time += duration;
+    if(--(*steps_left)) {
+        heap_push(&(partition->pending), event);
+    } else {
+        send_arrival(partition, event);
+    }
+}
+
+/**
+ * Run a partition until some time.
+ */
+static void partition_advance(partition_t *partition,
+                              const unsigned long until) {
+    while(heap_next_time(&(partition->pending)) < until) {
+        actor_step(partition, heap_pop(&(partition->pending)));
+    }
+}
+
+/**
+ * Find the end of the next window from the times that everyone published at
+ * the end of the last one, or 0 if the simulation is done. Every thread comes
+ * up with the same answer.
+ */
+static unsigned long window_end(void) {
+    unsigned long next = santa.next_time;
+    int i;
+    for(i = 0; i < num_partitions; ++i) {
+        if(partitions[i].next_time < next) {
+            next = partitions[i].next_time;
+        }
+    }
+    if(next >= config->end_time) {
+        return 0;
+    }
+    return next + lookahead < config->end_time
+         ? next + lookahead
+         : config->end_time;
+}
+
+/**
+ * Take the releases santa made for a partition during the last window.
+ */
+static void partition_deliver(partition_t *partition) {
+    int i;
+    for(i = 0; i < partition->num_releases; ++i) {
+        heap_push(&(partition->pending), partition->releases[i]);
+    }
+    partition->num_releases = 0;
+    partition->next_time = heap_next_time(&(partition->pending));
+}
+
+/**
+ * Take the arrivals at santa's door made during the last window.
+ */
+static void santa_deliver(void) {
+    partition_t *partition;
+    int i;
+    int j;
+    for(i = 0; i < num_partitions; ++i) {
+        partition = &(partitions[i]);
+        for(j = 0; j < partition->num_arrivals; ++j) {
+            heap_push(&(santa.arrivals), partition->arrivals[j]);
+        }
+        partition->num_arrivals = 0;
+    }
+    santa.next_time = santa_next_time();
+}
+
+/**
+ * Run one partition, one window at a time, in step with everyone else.
+ */
+static void *partition_thread(void *arg) {
+    partition_t *partition = (partition_t *) arg;
+    unsigned long until;
+
+    while(1) {
+        partition_deliver(partition);
+        pthread_barrier_wait(&window_barrier);
+        until = window_end();
+        if(!until) {
+            break;
+        }
+        partition_advance(partition, until);
+        pthread_barrier_wait(&window_barrier);
+    }
+
+    return NULL;
+}
+
+/**
+ * Run santa, and keep the windows, while the partitions run in their own
+ * threads.
+ */
+static void run_parallel(void) {
+    unsigned long until;
+    int i;
+
+    if(0 != pthread_barrier_init(&window_barrier, NULL,
+                                 (unsigned) num_partitions + 1)) {
+        perror("des_simulate[pthread_barrier_init]");
+        exit(EXIT_FAILURE);
+    }
+
+    for(i = 0; i < num_partitions; ++i) {
+        if(0 != pthread_create(&(partitions[i].thread), NULL,
+                               &partition_thread, &(partitions[i]))) {
+            perror("des_simulate[pthread_create]");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while(1) {
+        santa_deliver();
+        pthread_barrier_wait(&window_barrier);
+        until = window_end();
+        if(!until) {
+            break;
+        }
+        ++num_windows;
+        santa_advance(until);
+        pthread_barrier_wait(&window_barrier);
+    }
+
+    for(i = 0; i < num_partitions; ++i) {
+        pthread_join(partitions[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&window_barrier);
+}
+
+/**
+ * Run everything in one thread, one event time at a time.
+ */
+static void run_sequential(void) {
+    partition_t *partition = &(partitions[0]);
+    unsigned long now;
+    unsigned long next;
+
+    while(1) {
+        now = heap_next_time(&(partition->pending));
+        next = santa_next_time();
+        if(next < now) {
+            now = next;
+        }
+        if(now >= config->end_time) {
+            break;
+        }
+        partition_advance(partition, now + 1);
+        santa_advance(now + 1);
+    }
+}
+
+/**
+ * Set up the partitions and santa, and put every actor to work at time 0.
+ */
+static void init_processes(void) {
+    const int num_actors = config->num_elves + config->num_reindeer;
+    partition_t *partition;
+    int num_local;
+    int i;
+
+    partitions = (partition_t *) alloc_pool(
+        "des partitions", sizeof(partition_t) * num_partitions
+    );
+    for(i = 0; i < num_partitions; ++i) {
+        partition = &(partitions[i]);
+        num_local = (num_actors - i + num_partitions - 1) / num_partitions;
+        if(!num_local) {
+            continue;
+        }
+        partition->pending.events = (des_event_t *) alloc_pool(
+            "des queues", sizeof(des_event_t) * num_local
+        );
+        partition->arrivals = (des_event_t *) alloc_pool(
+            "des queues", sizeof(des_event_t) * num_local
+        );
+        partition->releases = (des_event_t *) alloc_pool(
+            "des queues", sizeof(des_event_t) * num_local
+        );
+        partition->rngs = (unsigned long *) alloc_pool(
+            "des actors", sizeof(unsigned long) * num_local
+        );
+        partition->steps_left = (int *) alloc_pool(
+            "des actors", sizeof(int) * num_local
+        );
+    }
+
+    memset(&santa, 0, sizeof santa);
+    santa.arrivals.events = (des_event_t *) alloc_pool(
+        "des queues", sizeof(des_event_t) * num_actors
+    );
+    santa.line = (int *) alloc_pool(
+        "des queues", sizeof(int) * config->num_elves
+    );
+    santa.rng = seed_random(-1);
+    santa.checksum = FNV_OFFSET_BASIS;
+    santa.next_time = NEVER;
+
+    for(i = 0; i < num_actors; ++i) {
+        partition = partition_of(i);
+        partition->rngs[i / num_partitions] = seed_random(i);
+        partition->pending.events[partition->pending.size].time = 0;
+        partition->pending.events[partition->pending.size].actor = i;
+        ++(partition->pending.size);
+    }
+
+    lookahead = config->min_step;
+    if(config->min_vacation < lookahead) {
+        lookahead = config->min_vacation;
+    }
+    if(config->min_help < lookahead) {
+        lookahead = config->min_help;
+    }
+    if(config->min_delivery < lookahead) {
+        lookahead = config->min_delivery;
+    }
+}
+
+/**
+ * Fill in the default configuration.
+ */
+void des_config_init(des_config_t *config) {
+    assert(NULL != config);
+    config->num_elves = 9;
+    config->num_reindeer = 9;
+    config->group_size = 3;
+    config->num_partitions = 0;
+    config->seed = 0;
+    config->end_time = DES_END_TIME;
+    config->min_step = DES_MIN_STEP;
+    config->max_step = DES_MAX_STEP;
+    config->max_steps = DES_MAX_STEPS;
+    config->min_vacation = DES_MIN_VACATION;
+    config->max_vacation = DES_MAX_VACATION;
+    config->min_help = DES_MIN_HELP;
+    config->max_help = DES_MAX_HELP;
+    config->min_delivery = DES_MIN_DELIVERY;
+    config->max_delivery = DES_MAX_DELIVERY;
+    config->workload = NULL;
+}
+
+/**
+ * Run the simulation and report what santa did.
+ *
+ * Returns: the process exit status.
+ */
+int des_simulate(const des_config_t *des_config) {
+    unsigned long start_ns;
+    unsigned long elapsed_ns;
+    unsigned long num_events;
+    int i;
+
+    assert(NULL != des_config);
+    assert(NULL != des_config->workload);
+
+    if(0 >= des_config->group_size
+    || des_config->num_elves < des_config->group_size
+    || 0 >= des_config->num_reindeer
+    || 0 > des_config->num_partitions
+    || DES_MAX_PARTITIONS < des_config->num_partitions
+    || 0 >= des_config->max_steps
+    || 0 == des_config->min_step || 0 == des_config->min_vacation
+    || 0 == des_config->min_help || 0 == des_config->min_delivery) {
+        fprintf(stderr, "At least a group of elves, one reindeer, 0 to %d "
+                        "partitions, and positive delays are supported.\n",
+            DES_MAX_PARTITIONS
+        );
+        return EXIT_FAILURE;
+    }
+
+    config = des_config;
+    is_parallel = 0 < config->num_partitions;
+    num_partitions = is_parallel ? config->num_partitions : 1;
+    init_processes();
+
+    start_ns = clock_ns();
+    if(is_parallel) {
+        run_parallel();
+    } else {
+        run_sequential();
+    }
+    elapsed_ns = clock_ns() - start_ns;
+
+    num_events = santa.num_events;
+    for(i = 0; i < num_partitions; ++i) {
+        num_events += partitions[i].num_events;
+    }
+
+    fprintf(stdout, "\n%d elves and %d reindeer until time %lu, ",
+        config->num_elves, config->num_reindeer, config->end_time
+    );
+    if(is_parallel) {
+        fprintf(stdout, "%d partitions:\n", num_partitions);
+    } else {
+        fprintf(stdout, "sequential:\n");
+    }
+    fprintf(stdout,
+        "    %lu elf groups helped, %lu deliveries, checksum %016lx\n"
+        "    %lu events in %.3fs, %.0f events/s",
+        santa.num_groups_helped, santa.num_deliveries, santa.checksum,
+        num_events, (double) elapsed_ns / NS_PER_SEC,
+        (double) num_events * NS_PER_SEC / (elapsed_ns ? elapsed_ns : 1)
+    );
+    if(is_parallel) {
+        fprintf(stdout, ", %lu windows of %lu ticks\n", num_windows, lookahead);
+    } else {
+        fprintf(stdout, "\n");
+    }
+
+    return EXIT_SUCCESS;
+}
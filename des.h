@@ -0,0 +1,64 @@
+/*
+ * des.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef DES_H_
+#define DES_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+#include "workload.h"
+
+#define DES_MAX_PARTITIONS 256
+
+/* how long the simulation runs for, in ticks of virtual time. A tick is one
+ * cycle of the original busy loop, and is also the amount of work that each
+ * event asks of the workload per tick that it covers. */
+#define DES_END_TIME 10000000UL
+
+/* the ranges that every random delay is drawn from, in ticks. The smallest
+ * of the minimums is the lookahead that the partitions synchronize on. */
+#define DES_MIN_STEP 1000UL
+#define DES_MAX_STEP 4000UL
+#define DES_MAX_STEPS 4
+#define DES_MIN_VACATION 20000UL
+#define DES_MAX_VACATION 60000UL
+#define DES_MIN_HELP 500UL
+#define DES_MAX_HELP 2000UL
+#define DES_MIN_DELIVERY 2000UL
+#define DES_MAX_DELIVERY 6000UL
+
+typedef struct {
+    int num_elves;
+    int num_reindeer;
+    int group_size;
+
+    /* 0 for the sequential engine. */
+    int num_partitions;
+
+    unsigned long seed;
+    unsigned long end_time;
+
+    /* an elf works through up to max_steps steps between needing help; a
+     * reindeer takes one vacation between deliveries. */
+    unsigned long min_step;
+    unsigned long max_step;
+    int max_steps;
+    unsigned long min_vacation;
+    unsigned long max_vacation;
+    unsigned long min_help;
+    unsigned long max_help;
+    unsigned long min_delivery;
+    unsigned long max_delivery;
+
+    const workload_t *workload;
+} des_config_t;
+
+void des_config_init(des_config_t *config);
+int des_simulate(const des_config_t *config);
+
+#endif /* DES_H_ */
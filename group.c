@@ -0,0 +1,151 @@
+/*
+ * group.c
+ *
+ *     Version: $Id$
+ *
+ * Library for releasing a whole group of waiting threads with one futex wake.
+ * Waiting on a group costs nothing until the group's generation changes, and
+ * publishing a group costs a single system call no matter how many threads
+ * are woken. The members of the most recent batch are published along with
+ * the generation so that each woken thread can figure out whether it was
+ * picked and where it falls within the batch.
+ *
+ * The published batch is only overwritten by the next call to group_publish,
+ * so it's up to the user to make sure that every member of a batch has seen
+ * it before publishing the next one.
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "group.h"
+
+/**
+ * Wait until *addr no longer holds the value val. Spurious wakeups are fine;
+ * callers always re-check.
+ */
+static void futex_wait(int *addr, const int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/**
+ * Wake up every thread waiting on addr.
+ */
+static void futex_wake_all(int *addr) {
+    if(-1 == syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0)) {
+        perror("futex_wake_all[futex]");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Sleep until the group's generation is no longer some value, counting the
+ * thread as a waiter while it's asleep.
+ */
+static void group_sleep(group_t *group, const int current) {
+    __atomic_add_fetch(&(group->num_waiters), 1, __ATOMIC_RELAXED);
+    futex_wait(&(group->generation), current);
+    __atomic_sub_fetch(&(group->num_waiters), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Initialize a group.
+ */
+void group_init(group_t *group) {
+    assert(NULL != group);
+    group->generation = 0;
+    group->num_waiters = 0;
+    group->size = 0;
+}
+
+/**
+ * Get the current generation of a group. A thread should read this before it
+ * can possibly be published, and then pass it along to group_wait.
+ */
+int group_generation(group_t *group) {
+    assert(NULL != group);
+    return __atomic_load_n(&(group->generation), __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Publish a batch of members and wake up everyone waiting on the group.
+ *
+ * Params: - Pointer to the group.
+ *         - Array of member ids in the batch.
+ *         - Number of members in the batch.
+ */
+void group_publish(group_t *group, const int *members, const int size) {
+    int i;
+
+    assert(NULL != group);
+    assert(0 <= size && size <= MAX_GROUP_SIZE);
+
+    for(i = 0; i < size; ++i) {
+        group->members[i] = members[i];
+    }
+    group->size = size;
+
+    __atomic_add_fetch(&(group->generation), 1, __ATOMIC_RELEASE);
+    futex_wake_all(&(group->generation));
+}
+
+/**
+ * Wait until the group's generation moves past some generation.
+ */
+void group_wait_generation(group_t *group, const int generation) {
+    int current;
+
+    assert(NULL != group);
+
+    while(generation == (current = group_generation(group))) {
+        group_sleep(group, current);
+    }
+}
+
+/**
+ * Wait until the group's generation is greater than some generation. This
+ * lets a group be used as a ticket counter, where each publish serves the
+ * next ticket in order.
+ */
+void group_wait_past(group_t *group, const int generation) {
+    int current;
+
+    assert(NULL != group);
+
+    while(generation >= (current = group_generation(group))) {
+        group_sleep(group, current);
+    }
+}
+
+/**
+ * Wait until a member is published as part of a batch.
+ *
+ * Params: - Pointer to the group.
+ *         - Id of the member that is waiting.
+ *         - Generation of the group read before the member could possibly
+ *           have been published.
+ *
+ * Returns: the position of the member within its batch.
+ */
+int group_wait(group_t *group, const int member, const int generation) {
+    int seen = generation;
+    int i;
+
+    assert(NULL != group);
+
+    while(1) {
+        group_wait_generation(group, seen);
+        seen = group_generation(group);
+
+        for(i = 0; i < group->size; ++i) {
+            if(member == group->members[i]) {
+                return i;
+            }
+        }
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * group.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef GROUP_H_
+#define GROUP_H_
+
+#include <stdlib.h>
+
+#include "assert.h"
+
+/* largest batch that can be published at once. */
+#define MAX_GROUP_SIZE 64
+
+/* A group-generation word. Waiters sleep on the generation; publishing a batch
+ * of members bumps the generation and wakes every waiter at once. The number
+ * of threads asleep on the generation is kept for the sampler; see
+ * sampler_watch_count. */
+typedef struct {
+    int generation;
+    int num_waiters;
+    int size;
+    int members[MAX_GROUP_SIZE];
+} group_t;
+
+void group_init(group_t *group);
+int group_generation(group_t *group);
+void group_publish(group_t *group, const int *members, const int size);
+int group_wait(group_t *group, const int member, const int generation);
+void group_wait_generation(group_t *group, const int generation);
+void group_wait_past(group_t *group, const int generation);
+
+#endif /* GROUP_H_ */
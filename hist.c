@@ -0,0 +1,334 @@
+/*
+ * hist.c
+ *
+ *     Version: $Id$
+ *
+ * Library for latency distributions. A histogram has a bucket for each of
+ * the first 2 * HIST_SUB_BUCKETS values, and then splits every power of two
+ * above that into HIST_SUB_BUCKETS equal parts, so that it covers every
+ * unsigned long in a fixed number of buckets and reports any value to within
+ * a few percent of itself, the way that HdrHistogram does.
+ *
+ * A histogram only ever has one writer, which adds to it with plain loads
+ * and stores (relaxed, so that readers don't race with it); recording is a
+ * count of leading zeros and a few adds. A recorder gives each thread that
+ * records into it a shard of its own, so threads never share a line or use
+ * an atomic, and any thread can merge the shards together while they're
+ * being recorded into without a lock; a merge that races with a recording
+ * sees the recording or not, but never half of one. Each thread gets its
+ * shard index the first time that it records into any recorder; threads past
+ * HIST_MAX_THREADS share one last shard using atomics.
+ *
+ * The serialized form is one line of text: the count, sum, min, and max,
+ * followed by the runs of non-empty buckets, each as its first bucket and
+ * then its counts:
+ *
+ *      count sum min max bucket:count,count,... bucket:count,...
+ */
+
+#include <string.h>
+#include <limits.h>
+
+#include "alloc.h"
+#include "clock.h"
+#include "hist.h"
+
+static __thread int thread_shard = -1;
+static int num_threads = 0;
+
+/**
+ * Get the bucket that a value goes in.
+ */
+static int bucket_of(const unsigned long value) {
+    int shift;
+    if(value < 2 * HIST_SUB_BUCKETS) {
+        return (int) value;
+    }
+    shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_BUCKETS
+         + (int) (value >> shift) - HIST_SUB_BUCKETS;
+}
+
+/**
+ * Get the smallest value that goes in a bucket.
+ */
+static unsigned long bucket_floor(const int bucket) {
+    int shift;
+    if(bucket < 2 * HIST_SUB_BUCKETS) {
+        return (unsigned long) bucket;
+    }
+    shift = bucket / HIST_SUB_BUCKETS - 1;
+    return (unsigned long) (bucket - shift * HIST_SUB_BUCKETS) << shift;
+}
+
+/**
+ * Get the largest value that goes in a bucket.
+ */
+static unsigned long bucket_ceiling(const int bucket) {
+    if(bucket + 1 == HIST_NUM_BUCKETS) {
+        return ULONG_MAX;
+    }
+    return bucket_floor(bucket + 1) - 1;
+}
+
+/**
+ * Add to a word that only the calling thread writes.
+ */
+static void bump(unsigned long *word, const unsigned long amount) {
+    __atomic_store_n(word,
+        __atomic_load_n(word, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED
+    );
+}
+
+/**
+ * Read a word that another thread might be writing.
+ */
+static unsigned long peek(const unsigned long *word) {
+    return __atomic_load_n(word, __ATOMIC_RELAXED);
+}
+
+/**
+ * Empty out a histogram.
+ */
+void hist_clear(hist_t *hist) {
+    assert(NULL != hist);
+    memset(hist, 0, sizeof *hist);
+    hist->min = ULONG_MAX;
+}
+
+/**
+ * Add a value to a histogram. Only one thread may add to a histogram, but any
+ * thread may merge it into another at the same time.
+ */
+void hist_add(hist_t *hist, const unsigned long value) {
+    bump(&(hist->buckets[bucket_of(value)]), 1);
+    bump(&(hist->sum), value);
+    if(value < hist->min) {
+        __atomic_store_n(&(hist->min), value, __ATOMIC_RELAXED);
+    }
+    if(value > hist->max) {
+        __atomic_store_n(&(hist->max), value, __ATOMIC_RELAXED);
+    }
+    bump(&(hist->count), 1);
+}
+
+/**
+ * Add a value to a histogram that many threads add to.
+ */
+static void hist_add_shared(hist_t *hist, const unsigned long value) {
+    unsigned long seen;
+
+    __sync_fetch_and_add(&(hist->buckets[bucket_of(value)]), 1);
+    __sync_fetch_and_add(&(hist->sum), value);
+    seen = peek(&(hist->min));
+    while(value < seen
+       && !__sync_bool_compare_and_swap(&(hist->min), seen, value)) {
+        seen = peek(&(hist->min));
+    }
+    seen = peek(&(hist->max));
+    while(value > seen
+       && !__sync_bool_compare_and_swap(&(hist->max), seen, value)) {
+        seen = peek(&(hist->max));
+    }
+    __sync_fetch_and_add(&(hist->count), 1);
+}
+
+/**
+ * Merge one histogram into another. The histogram being merged from can be
+ * added to while this happens; its count is taken from its buckets so that
+ * the merged histogram is consistent with itself.
+ *
+ * Params: - The histogram to merge into, which only the caller may use.
+ *         - The histogram to merge from.
+ */
+void hist_merge(hist_t *into, const hist_t *from) {
+    unsigned long count;
+    unsigned long value;
+    int i;
+
+    assert(NULL != into);
+    assert(NULL != from);
+
+    for(i = 0; i < HIST_NUM_BUCKETS; ++i) {
+        count = peek(&(from->buckets[i]));
+        into->buckets[i] += count;
+        into->count += count;
+    }
+    into->sum += peek(&(from->sum));
+    if((value = peek(&(from->min))) < into->min) {
+        into->min = value;
+    }
+    if((value = peek(&(from->max))) > into->max) {
+        into->max = value;
+    }
+}
+
+/**
+ * Get the value that some percentage of the values are at or below, to
+ * within the precision of a bucket.
+ *
+ * Params: - The histogram.
+ *         - The percentile, from 0 to 100.
+ *
+ * Returns: the largest value of the bucket that the percentile falls in, or
+ *          the histogram's max if that's smaller; 0 if there are no values.
+ */
+unsigned long hist_percentile(const hist_t *hist, const double percentile) {
+    unsigned long rank;
+    unsigned long seen = 0;
+    int i;
+
+    assert(NULL != hist);
+    assert(0.0 <= percentile && percentile <= 100.0);
+
+    if(!hist->count) {
+        return 0;
+    }
+
+    rank = (unsigned long) (percentile / 100.0 * (double) hist->count + 0.5);
+    if(!rank) {
+        rank = 1;
+    }
+
+    for(i = 0; i < HIST_NUM_BUCKETS; ++i) {
+        seen += hist->buckets[i];
+        if(seen >= rank) {
+            break;
+        }
+    }
+    return bucket_ceiling(i) < hist->max ? bucket_ceiling(i) : hist->max;
+}
+
+/**
+ * Print out the number of values in a histogram, their mean, median, 99th
+ * and 99.9th percentiles, and maximum, in nanoseconds.
+ *
+ * Params: - The histogram.
+ *         - Name to print the histogram under.
+ *         - Number of nanoseconds that each unit of a value is.
+ *         - Where to print it.
+ */
+void hist_print(const hist_t *hist,
+                const char *name,
+                const double ns_per_unit,
+                FILE *out) {
+    if(!hist->count) {
+        fprintf(out, "    %s: no samples\n", name);
+        return;
+    }
+
+    fprintf(out,
+        "    %s: %lu samples, mean %.0f ns, p50 %.0f ns, p99 %.0f ns, "
+        "p99.9 %.0f ns, max %.0f ns\n",
+        name, hist->count, ns_per_unit * hist->sum / hist->count,
+        ns_per_unit * hist_percentile(hist, 50.0),
+        ns_per_unit * hist_percentile(hist, 99.0),
+        ns_per_unit * hist_percentile(hist, 99.9),
+        ns_per_unit * hist->max
+    );
+}
+
+/**
+ * Write a histogram out in its serialized form, as one line.
+ */
+void hist_write(const hist_t *hist, FILE *out) {
+    int i;
+    int in_run = 0;
+
+    fprintf(out, "%lu %lu %lu %lu",
+        hist->count, hist->sum, hist->count ? hist->min : 0, hist->max
+    );
+    for(i = 0; i < HIST_NUM_BUCKETS; ++i) {
+        if(!hist->buckets[i]) {
+            in_run = 0;
+        } else if(in_run) {
+            fprintf(out, ",%lu", hist->buckets[i]);
+        } else {
+            fprintf(out, " %d:%lu", i, hist->buckets[i]);
+            in_run = 1;
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * Initialize a recorder, with a shard for every thread.
+ *
+ * Params: - Pointer to the recorder.
+ *         - Name to report the recorder under.
+ *         - 1 if values are clock ticks, 0 if they're nanoseconds.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void hist_recorder_init(hist_recorder_t *recorder,
+                        const char *name,
+                        const int in_ticks) {
+    int i;
+
+    assert(NULL != recorder);
+
+    recorder->name = name;
+    recorder->in_ticks = in_ticks;
+    recorder->shards = (hist_t *) alloc_pool(
+        "histograms", sizeof(hist_t) * (HIST_MAX_THREADS + 1)
+    );
+    for(i = 0; i <= HIST_MAX_THREADS; ++i) {
+        hist_clear(&(recorder->shards[i]));
+    }
+}
+
+/**
+ * Record a value into the calling thread's shard. Safe to call from any
+ * thread.
+ */
+void hist_record(hist_recorder_t *recorder, const unsigned long value) {
+    if(0 > thread_shard) {
+        thread_shard = __sync_fetch_and_add(&num_threads, 1);
+    }
+    if(thread_shard < HIST_MAX_THREADS) {
+        hist_add(&(recorder->shards[thread_shard]), value);
+    } else {
+        hist_add_shared(&(recorder->shards[HIST_MAX_THREADS]), value);
+    }
+}
+
+/**
+ * Merge every shard of a recorder into one histogram, replacing whatever was
+ * in it. Safe to call while threads are recording.
+ */
+void hist_snapshot(const hist_recorder_t *recorder, hist_t *hist) {
+    int shards = __atomic_load_n(&num_threads, __ATOMIC_RELAXED);
+    int i;
+
+    hist_clear(hist);
+    for(i = 0; i < shards && i < HIST_MAX_THREADS; ++i) {
+        hist_merge(hist, &(recorder->shards[i]));
+    }
+    hist_merge(hist, &(recorder->shards[HIST_MAX_THREADS]));
+}
+
+/**
+ * Get the number of values recorded so far.
+ */
+unsigned long hist_count(const hist_recorder_t *recorder) {
+    int shards = __atomic_load_n(&num_threads, __ATOMIC_RELAXED);
+    unsigned long count = 0;
+    int i;
+
+    for(i = 0; i < shards && i < HIST_MAX_THREADS; ++i) {
+        count += peek(&(recorder->shards[i].count));
+    }
+    return count + peek(&(recorder->shards[HIST_MAX_THREADS].count));
+}
+
+/**
+ * Print out a summary of everything recorded so far, converting ticks to
+ * nanoseconds.
+ */
+void hist_report(const hist_recorder_t *recorder, FILE *out) {
+    static hist_t snapshot;
+    hist_snapshot(recorder, &snapshot);
+    hist_print(&snapshot, recorder->name,
+        recorder->in_ticks ? clock_ns_per_tick() : 1.0, out
+    );
+}
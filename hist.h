@@ -0,0 +1,61 @@
+/*
+ * hist.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef HIST_H_
+#define HIST_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+/* every power of two is split into 2^HIST_SUB_BITS linear buckets, so any
+ * value is kept to within 1 / 2^HIST_SUB_BITS of itself. */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_NUM_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/* threads past this many all record into one shared shard, with atomics. */
+#define HIST_MAX_THREADS 64
+
+/* A log-linear histogram of values, usually nanoseconds. */
+typedef struct {
+    unsigned long count;
+    unsigned long sum;
+    unsigned long min;
+    unsigned long max;
+    unsigned long buckets[HIST_NUM_BUCKETS];
+} hist_t;
+
+/* A histogram that any thread can record into, as one shard per thread. Its
+ * values are either nanoseconds or clock ticks; see clock.h. */
+typedef struct {
+    const char *name;
+    int in_ticks;
+    hist_t *shards;
+} hist_recorder_t;
+
+/* operations on a single histogram */
+void hist_clear(hist_t *hist);
+void hist_add(hist_t *hist, const unsigned long value);
+void hist_merge(hist_t *into, const hist_t *from);
+unsigned long hist_percentile(const hist_t *hist, const double percentile);
+void hist_print(const hist_t *hist,
+                const char *name,
+                const double ns_per_unit,
+                FILE *out);
+void hist_write(const hist_t *hist, FILE *out);
+
+/* operations on a recorder */
+void hist_recorder_init(hist_recorder_t *recorder,
+                        const char *name,
+                        const int in_ticks);
+void hist_record(hist_recorder_t *recorder, const unsigned long value);
+void hist_snapshot(const hist_recorder_t *recorder, hist_t *hist);
+unsigned long hist_count(const hist_recorder_t *recorder);
+void hist_report(const hist_recorder_t *recorder, FILE *out);
+
+#endif /* HIST_H_ */
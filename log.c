@@ -0,0 +1,532 @@
+/*
+ * log.c
+ *
+ *     Version: $Id$
+ *
+ * Library for getting log output off of the threads that produce it. Logging
+ * a message only copies it into the active buffer; a writer thread hands full
+ * buffers (and partly full ones every LOG_FLUSH_INTERVAL_NS) to the kernel
+ * while the other buffer fills up. This way a slow disk, terminal, or pipe
+ * holds up the writer thread and nobody else. If both buffers are waiting to
+ * be written then messages are dropped and counted rather than making the
+ * logging thread wait.
+ *
+ * Buffers are written with io_uring when the kernel supports it: the buffers
+ * and the file are registered with the ring once, every buffer that is ready
+ * goes in with a single io_uring_enter, linked so that they are written in
+ * order, and all of their completions are reaped together. Otherwise, the
+ * writer thread falls back on plain blocking writes.
+ *
+ * Until log_open is called, messages go straight to standard output.
+ *
+ * Messages are normally logged through the LOG_* macros in log.h, which skip
+ * formatting a message that is below the runtime level, and compile it out
+ * entirely if it's below LOG_COMPILE_LEVEL.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "clock.h"
+#include "log.h"
+#include "alloc.h"
+
+typedef enum {
+    LOG_DIRECT,
+    LOG_BUFFERED,
+    LOG_CLOSED
+} log_state_t;
+
+typedef struct {
+    char data[LOG_BUFFER_SIZE];
+    size_t length;
+
+    /* has the buffer been handed off to the writer? buffers are handed off
+     * in sequence order, and must be written in the same order. */
+    int is_full;
+    unsigned long sequence;
+
+    /* how much of the buffer the writer has written so far. */
+    size_t num_written;
+} log_buffer_t;
+
+/* the parts of an io_uring that the writer uses, and its mappings. */
+typedef struct {
+    int fd;
+    char *sq_ptr;
+    char *cq_ptr;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+} log_ring_t;
+
+static log_buffer_t buffers[LOG_NUM_BUFFERS];
+static int active = 0;
+static unsigned long next_sequence = 0;
+static log_state_t state = LOG_DIRECT;
+static int closing = 0;
+static int log_fd = -1;
+static log_ring_t ring = {-1};
+
+/* whether the buffers were written through the ring, which is still true
+ * after the writer closes it on the way out, but not if it gave up on it. */
+static int used_ring = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buffer_full = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+
+/* the runtime log level; see LOG_AT. */
+int log_level = LOG_COMPILE_LEVEL;
+
+const char *log_level_names[] = {"debug", "info", "warn", "none", NULL};
+
+static unsigned long num_bytes = 0;
+static unsigned long num_dropped = 0;
+static unsigned long num_buffers_written = 0;
+static unsigned long num_system_calls = 0;
+
+/**
+ * Unmap and close the io_uring, if it's open, after which only blocking
+ * writes are used.
+ */
+static void ring_close(void) {
+    if(0 > ring.fd) {
+        return;
+    }
+    if(NULL != ring.sq_ptr && MAP_FAILED != (void *) ring.sq_ptr) {
+        munmap(ring.sq_ptr, ring.sq_size);
+    }
+    if(NULL != ring.cq_ptr && MAP_FAILED != (void *) ring.cq_ptr) {
+        munmap(ring.cq_ptr, ring.cq_size);
+    }
+    if(NULL != ring.sqes && MAP_FAILED != (void *) ring.sqes) {
+        munmap(ring.sqes, ring.sqes_size);
+    }
+    close(ring.fd);
+    ring.fd = -1;
+    ring.sq_ptr = NULL;
+    ring.cq_ptr = NULL;
+    ring.sqes = NULL;
+}
+
+/**
+ * Set up an io_uring for writing the log buffers to a file, registering the
+ * buffers and the file with it.
+ *
+ * Returns: 1 if the ring is ready, 0 if io_uring can't be used.
+ */
+static int ring_open(const int fd) {
+    struct io_uring_params params;
+    struct iovec iovecs[LOG_NUM_BUFFERS];
+    int i;
+
+    memset(&params, 0, sizeof params);
+    ring.fd = (int) syscall(__NR_io_uring_setup, 2 * LOG_NUM_BUFFERS, &params);
+    if(0 > ring.fd) {
+        return 0;
+    }
+
+    /* writing at the file's current position needs IORING_FEAT_RW_CUR_POS,
+     * otherwise a pipe or terminal can't be written to. */
+    if(!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring.fd);
+        ring.fd = -1;
+        return 0;
+    }
+
+    ring.sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_size = params.cq_off.cqes
+                 + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sq_ptr = (char *) mmap(NULL, ring.sq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING
+    );
+    ring.cq_ptr = (char *) mmap(NULL, ring.cq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING
+    );
+    ring.sqes = (struct io_uring_sqe *) mmap(NULL, ring.sqes_size,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+        IORING_OFF_SQES
+    );
+
+    if(MAP_FAILED == (void *) ring.sq_ptr
+    || MAP_FAILED == (void *) ring.cq_ptr
+    || MAP_FAILED == (void *) ring.sqes) {
+        ring_close();
+        return 0;
+    }
+
+    ring.sq_tail = (unsigned *) (ring.sq_ptr + params.sq_off.tail);
+    ring.sq_mask = (unsigned *) (ring.sq_ptr + params.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (ring.sq_ptr + params.sq_off.array);
+    ring.cq_head = (unsigned *) (ring.cq_ptr + params.cq_off.head);
+    ring.cq_tail = (unsigned *) (ring.cq_ptr + params.cq_off.tail);
+    ring.cq_mask = (unsigned *) (ring.cq_ptr + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (ring.cq_ptr + params.cq_off.cqes);
+
+    for(i = 0; i < LOG_NUM_BUFFERS; ++i) {
+        iovecs[i].iov_base = &(buffers[i].data[0]);
+        iovecs[i].iov_len = LOG_BUFFER_SIZE;
+    }
+
+    if(0 > syscall(__NR_io_uring_register,
+            ring.fd, IORING_REGISTER_BUFFERS, iovecs, LOG_NUM_BUFFERS)
+    || 0 > syscall(__NR_io_uring_register,
+            ring.fd, IORING_REGISTER_FILES, &fd, 1)) {
+        ring_close();
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Write what's left of some buffers using blocking writes.
+ *
+ * Returns: the number of bytes that couldn't be written, which the caller
+ *          adds to num_dropped under the lock.
+ */
+static unsigned long write_blocking(log_buffer_t **pending,
+                                    const int num_pending) {
+    log_buffer_t *buffer;
+    ssize_t written;
+    unsigned long dropped = 0;
+    int i;
+
+    for(i = 0; i < num_pending; ++i) {
+        buffer = pending[i];
+        while(buffer->num_written < buffer->length) {
+            ++num_system_calls;
+            written = write(log_fd,
+                &(buffer->data[buffer->num_written]),
+                buffer->length - buffer->num_written
+            );
+            if(0 > written && EINTR == errno) {
+                continue;
+            } else if(0 >= written) {
+                dropped += buffer->length - buffer->num_written;
+                break;
+            }
+            buffer->num_written += (size_t) written;
+        }
+    }
+    return dropped;
+}
+
+/**
+ * Write some buffers, in order, through the io_uring. Each round submits one
+ * linked write per unfinished buffer and reaps all of their completions with
+ * the same system call. A short write cancels the writes linked after it, so
+ * the next round picks up where each buffer left off without reordering.
+ *
+ * Returns: 1 if everything was written, 0 if the ring failed and the rest
+ *          needs to be written some other way.
+ */
+static int write_ring(log_buffer_t **pending, const int num_pending) {
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    log_buffer_t *buffer;
+    unsigned tail;
+    unsigned head;
+    unsigned index;
+    int num_submitted;
+    int i;
+
+    while(1) {
+        tail = *(ring.sq_tail);
+        num_submitted = 0;
+
+        for(i = 0; i < num_pending; ++i) {
+            buffer = pending[i];
+            if(buffer->num_written >= buffer->length) {
+                continue;
+            }
+
+            index = tail & *(ring.sq_mask);
+            sqe = &(ring.sqes[index]);
+            memset(sqe, 0, sizeof *sqe);
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+            sqe->fd = 0;
+            sqe->addr = (unsigned long) &(buffer->data[buffer->num_written]);
+            sqe->len = (unsigned) (buffer->length - buffer->num_written);
+            sqe->off = (unsigned long) -1;
+            sqe->buf_index = (unsigned short) (buffer - &(buffers[0]));
+            sqe->user_data = (unsigned long) buffer;
+            ring.sq_array[index] = index;
+
+            ++tail;
+            ++num_submitted;
+        }
+
+        if(!num_submitted) {
+            return 1;
+        }
+
+        /* the last write in the batch doesn't link to anything. */
+        ring.sqes[(tail - 1) & *(ring.sq_mask)].flags = IOSQE_FIXED_FILE;
+        __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        ++num_system_calls;
+        if(0 > syscall(__NR_io_uring_enter, ring.fd, num_submitted,
+                num_submitted, IORING_ENTER_GETEVENTS, NULL, 0)) {
+            if(EINTR == errno) {
+                continue;
+            }
+            return 0;
+        }
+
+        head = *(ring.cq_head);
+        while(head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &(ring.cqes[head & *(ring.cq_mask)]);
+            buffer = (log_buffer_t *) (unsigned long) cqe->user_data;
+            if(0 < cqe->res) {
+                buffer->num_written += (size_t) cqe->res;
+            } else if(-ECANCELED != cqe->res && -EAGAIN != cqe->res) {
+                __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            ++head;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Hand the active buffer off to the writer and move on to the next one. The
+ * lock must be held.
+ */
+static void hand_off(void) {
+    log_buffer_t *buffer = &(buffers[active]);
+    if(buffer->is_full || !buffer->length) {
+        return;
+    }
+    buffer->is_full = 1;
+    buffer->sequence = next_sequence++;
+    buffer->num_written = 0;
+    active = (active + 1) % LOG_NUM_BUFFERS;
+    pthread_cond_signal(&buffer_full);
+}
+
+/**
+ * Get the buffers that have been handed off to the writer, oldest first. The
+ * lock must be held.
+ */
+static int take_full(log_buffer_t **pending) {
+    log_buffer_t *swap;
+    int num_pending = 0;
+    int i;
+    int j;
+
+    for(i = 0; i < LOG_NUM_BUFFERS; ++i) {
+        if(buffers[i].is_full) {
+            pending[num_pending++] = &(buffers[i]);
+        }
+    }
+
+    for(i = 1; i < num_pending; ++i) {
+        for(j = i; 0 < j && pending[j - 1]->sequence > pending[j]->sequence; --j) {
+            swap = pending[j];
+            pending[j] = pending[j - 1];
+            pending[j - 1] = swap;
+        }
+    }
+
+    return num_pending;
+}
+
+/**
+ * Write out buffers as they are handed off, and hand off partly filled
+ * buffers that have been sitting for too long.
+ */
+static void *log_writer(void *_) {
+    log_buffer_t *pending[LOG_NUM_BUFFERS];
+    unsigned long deadline;
+    struct timespec until;
+    unsigned long dropped;
+    int num_pending;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    while(1) {
+        num_pending = take_full(&(pending[0]));
+
+        if(!num_pending) {
+            if(closing) {
+                hand_off();
+                if(!take_full(&(pending[0]))) {
+                    break;
+                }
+                continue;
+            }
+
+            clock_gettime(CLOCK_REALTIME, &until);
+            deadline = (unsigned long) until.tv_nsec + LOG_FLUSH_INTERVAL_NS;
+            until.tv_sec += (time_t) (deadline / NS_PER_SEC);
+            until.tv_nsec = (long) (deadline % NS_PER_SEC);
+            if(ETIMEDOUT == pthread_cond_timedwait(&buffer_full, &lock, &until)) {
+                hand_off();
+            }
+            continue;
+        }
+
+        pthread_mutex_unlock(&lock);
+        dropped = 0;
+        if(0 <= ring.fd && !write_ring(&(pending[0]), num_pending)) {
+            ring_close(); /* give up on the ring for good. */
+            used_ring = 0;
+        }
+        if(0 > ring.fd) {
+            dropped = write_blocking(&(pending[0]), num_pending);
+        }
+        pthread_mutex_lock(&lock);
+
+        num_dropped += dropped;
+
+        for(i = 0; i < num_pending; ++i) {
+            pending[i]->length = 0;
+            pending[i]->is_full = 0;
+            ++num_buffers_written;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    ring_close();
+
+    return NULL;
+}
+
+/**
+ * Start sending log messages through the writer thread to a file.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void log_open(const int fd) {
+    assert(0 <= fd);
+    assert(LOG_DIRECT == state);
+
+    fflush(stdout);
+    log_fd = fd;
+    used_ring = ring_open(fd);
+    alloc_account("log buffers", sizeof buffers);
+
+    pthread_mutex_lock(&lock);
+    state = LOG_BUFFERED;
+    pthread_mutex_unlock(&lock);
+
+    if(0 != pthread_create(&writer, NULL, &log_writer, NULL)) {
+        perror("log_open[pthread_create]");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * Write out everything that has been logged so far and stop the writer.
+ * Messages logged after this are dropped.
+ */
+void log_close(void) {
+    int was_buffered;
+
+    pthread_mutex_lock(&lock);
+    was_buffered = (LOG_BUFFERED == state);
+    if(was_buffered) {
+        state = LOG_CLOSED;
+        closing = 1;
+        pthread_cond_signal(&buffer_full);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if(was_buffered) {
+        pthread_join(writer, NULL);
+    }
+}
+
+/**
+ * Log some bytes.
+ */
+void log_write(const void *data, const size_t length) {
+    log_buffer_t *buffer;
+
+    pthread_mutex_lock(&lock);
+
+    if(LOG_DIRECT == state) {
+        pthread_mutex_unlock(&lock);
+        fwrite(data, 1, length, stdout);
+        return;
+    }
+
+    buffer = &(buffers[active]);
+    if(LOG_BUFFERED == state
+    && !buffer->is_full
+    && LOG_BUFFER_SIZE < buffer->length + length) {
+        hand_off();
+        buffer = &(buffers[active]);
+    }
+
+    if(LOG_BUFFERED != state
+    || buffer->is_full
+    || LOG_BUFFER_SIZE < buffer->length + length) {
+        num_dropped += length;
+    } else {
+        memcpy(&(buffer->data[buffer->length]), data, length);
+        buffer->length += length;
+        num_bytes += length;
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Log a formatted message of at most LOG_MAX_MESSAGE bytes.
+ */
+void log_printf(const char *format, ...) {
+    char message[LOG_MAX_MESSAGE];
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    length = vsnprintf(&(message[0]), sizeof message, format, args);
+    va_end(args);
+
+    if(0 < length) {
+        log_write(&(message[0]),
+            (size_t) length < sizeof message ? (size_t) length
+                                             : sizeof message - 1
+        );
+    }
+}
+
+/**
+ * Print out how much was logged and what it cost.
+ */
+void log_report(FILE *out) {
+    if(LOG_DIRECT == state) {
+        return;
+    }
+    fprintf(out,
+        "log: %lu bytes in %lu buffers, %lu system calls using %s, "
+        "%lu bytes dropped\n",
+        num_bytes, num_buffers_written, num_system_calls,
+        used_ring ? "io_uring" : "write",
+        num_dropped
+    );
+}
@@ -0,0 +1,62 @@
+/*
+ * log.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+/* size of each of the buffers that messages are copied into; one buffer is
+ * filled while the other is being written out. */
+#define LOG_BUFFER_SIZE (1 << 16)
+#define LOG_NUM_BUFFERS 2
+
+/* longest message that can be logged at once. */
+#define LOG_MAX_MESSAGE 256
+
+/* how long a partly filled buffer can sit before it is written out. */
+#define LOG_FLUSH_INTERVAL_NS 10000000UL
+
+/* log levels, from most to least chatty. */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_NONE 3
+
+/* messages below this level are compiled out entirely; messages at or above
+ * it are still checked against log_level at runtime. */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/* The logging macros take the arguments to log_printf in an extra set of
+ * parentheses, e.g. LOG_INFO(("Elf %d has retired.\n", id)), as there are
+ * no variadic macros in C89. Nothing is formatted unless the message is at or
+ * above the runtime level. */
+#define LOG_AT(level, args) \
+    do { \
+        if(LOG_COMPILE_LEVEL <= (level) && log_level <= (level)) { \
+            log_printf args; \
+        } \
+    } while(0)
+
+#define LOG_DEBUG(args) LOG_AT(LOG_LEVEL_DEBUG, args)
+#define LOG_INFO(args) LOG_AT(LOG_LEVEL_INFO, args)
+#define LOG_WARN(args) LOG_AT(LOG_LEVEL_WARN, args)
+
+extern int log_level;
+extern const char *log_level_names[];
+
+void log_open(const int fd);
+void log_close(void);
+void log_printf(const char *format, ...);
+void log_write(const void *data, const size_t length);
+void log_report(FILE *out);
+
+#endif /* LOG_H_ */
@@ -54,23 +54,126 @@
  * to gain mutual exclusion but to signal action, the "critical sections"
  * (although technically they aren't critical) end up spanning multiple
  * functions. Such cases are, however, too difficult to reason about.
+ *
+ * The elf side of the protocol above is run independently in each region; a
+ * region's sleep mutex plays the part of santa_sleep_mutex, and its state word
+ * (see state.c) has taken over from santa_busy_mutex: santa moves it from
+ * sleeping to helping, the last elf he helped moves it back, and the head
+ * santa moves it from sleeping to preparing and back around preparing a
+ * sleigh. The head santa takes each region's word in turn and never holds
+ * one while waiting on another region's, so the regions don't add any new
+ * cycles.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <sched.h>
 #include <pthread.h>
 #include <signal.h>
 #include <time.h>
 #include <limits.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "assert.h"
 #include "sem.h"
 #include "set.h"
+#include "pset.h"
+#include "group.h"
+#include "trace.h"
+#include "clock.h"
+#include "hist.h"
+#include "santa_coro.h"
+#include "des.h"
+#include "cores.h"
+#include "workload.h"
+#include "scenario.h"
+#include "log.h"
+#include "watchdog.h"
+#include "sampler.h"
+#include "prof.h"
+#include "alloc.h"
+#include "state.h"
 
 #define NUM_REINDEER 10
 #define NUM_ELVES 9
 #define NUM_ELVES_PER_GROUP 3
+#define MAX_ELVES_PER_GROUP 16
+
+/* elves are split up into regions by id, each with its own regional santa
+ * that helps the region's elves. the head santa only deals with the reindeer.
+ * the number of regions can be changed with -r. */
+#define NUM_REGIONS 1
+#define MAX_REGIONS 16
+
+/* the herd forms teams of reindeer as they come back from vacation, and each
+ * team flies its own sleigh; up to NUM_SLEIGHS sleighs can be out delivering
+ * at once. a team size of 0 means the whole herd. the simulation ends after
+ * NUM_DELIVERIES sleighs have come back. these can be changed with -T, -S,
+ * and -D. */
+#define TEAM_SIZE 0
+#define NUM_SLEIGHS 1
+#define MAX_SLEIGHS 16
+#define NUM_DELIVERIES 1
+
+/* upper bounds on the population once elves and reindeer can be hired and
+ * retired while the simulation runs. all per-elf and per-reindeer structures
+ * are sized to these up front so that they never need to be reallocated. */
+#define MAX_ELVES 64
+#define MAX_REINDEER 32
+
+/* longest control command that will be read from standard input */
+#define MAX_COMMAND_LENGTH 80
+
+/* should santa release a group of elves with one futex wake on elf_group
+ * instead of signalling each elf's semaphore in elf_line_set? */
+#define GROUP_WAKE 1
+
+/* how elves get into a group: ADMISSION_SET lines them up through
+ * elf_counting_sem, elf_mutex, and the elves_waiting set; ADMISSION_TICKETS
+ * has each elf take a ticket instead, and the elf's group is its ticket
+ * divided by the group size; ADMISSION_OLDEST puts every elf that needs help
+ * straight into the elves_by_age priority set, and santa helps the oldest
+ * ones first. this can be changed with -A. */
+#define ADMISSION ADMISSION_SET
+
+/* should a santa that has been woken up keep serving whatever is ready, i.e.
+ * every full group of elves or every team of reindeer, before going back to
+ * sleep, instead of serving one and going through his sleep mutex again?
+ * this can be turned on with -d. */
+#define DRAIN 0
+
+/* should the actors' messages be handed off to a writer thread (see log.c)
+ * instead of being written to standard output by the actors themselves? */
+#define ASYNC_LOG 1
+
+/* in quiet mode (-q), nothing is narrated; instead, aggregate counters are
+ * printed this often. */
+#define QUIET 0
+#define QUIET_INTERVAL_NS NS_PER_SEC
+
+/* how long none of the actors can change state before the watchdog dumps
+ * what everyone is doing; 0 turns the watchdog off. this can be changed with
+ * -W, in milliseconds. */
+#define WATCHDOG_STALL_MS 5000
+
+/* most experiments that one fork server will run. */
+#define MAX_EXPERIMENTS 256
+
+/* how often the semaphore queue depths are sampled when -Q is given. */
+#define SAMPLE_PERIOD_US 1000
+
+/* how much CPU time there is between profile samples when -p is given, and
+ * how many stack frames each sample keeps under the actor's state; 0 frames
+ * profiles the states alone. */
+#define PROFILE_PERIOD_US 1000
+#define PROFILE_DEPTH 8
 
 /* should "waits" take up time? */
 #define OBSERVABLE_DELAYS 1
@@ -78,6 +181,33 @@
 /* max wait time (in approx. cycles) if OBSERVABLE_DELAYS is set */
 #define MAX_WAIT_TIME (INT_MAX >> 4)
 
+/* max time (in approx. cycles) that santa spends helping a single elf. */
+#define MAX_HELP_TIME (MAX_WAIT_TIME >> 3)
+
+/* should the reindeer interrupt santa while he's helping elves? if so, then
+ * santa stops between elves, leaving the rest of the group in line to be
+ * helped first once the sleigh is ready. this can be turned on with -P. */
+#define PREEMPTION 0
+
+/* what the actors do while they wait; see workload.c. this can be changed
+ * with -w. */
+#define WORKLOAD "spin"
+
+/* how the length of each wait is drawn from between 0 and its max time. */
+#define WAIT_DELAY DELAY_UNIFORM
+#define HELP_DELAY DELAY_UNIFORM
+
+/* which cpus the threads are pinned to. */
+#define PLACEMENT PLACEMENT_NONE
+
+/* what to put in the report. */
+#define METRICS \
+    (METRIC_THROUGHPUT | METRIC_DELIVERIES | METRIC_LATENCY | METRIC_STATES)
+
+/* stop after this many seconds even if the sleighs haven't come back; 0 means
+ * to only stop once they have. */
+#define DURATION 0
+
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
 /*
@@ -91,57 +221,403 @@
 /* set of semaphores used to figure out which elves are currently in line. each
  * elf is given its own semaphore, and in a sense, santa dispatches to the
  * elves that he can help them by signalling particular semaphores in the set.
- * all semaphores in the set start off as locked.
+ * all semaphores in the set start off as locked. there is one semaphore for
+ * every elf that could ever be hired, i.e. MAX_ELVES.
  */
 static sem_set_t elf_line_set;
 
 /* set of all semaphores (sem_t) listed below. */
 static sem_set_t sem_set;
 
-/* mutexes to keep track of whether or not santa is working with elves or on
- * the sleigh, and whether or not santa is currently asleep. */
-static sem_t santa_busy_mutex;
+/* mutex to keep track of whether or not the head santa is asleep. */
 static sem_t santa_sleep_mutex;
 
-/* used to signal when reindeer can start getting hitched, when santa has
- * prepared the sleigh, he signals this counter NUM_REINDEER_TIMES. */
-static sem_t reindeer_counting_sem;
-
-/* keep track of how many reindeer are in line, and then how many reindeer have
- * been hitched; locked by reindeer_counter_lock. */
+/* keep track of how many reindeer are in the team being formed, and of the
+ * teams that have been formed; locked by reindeer_counter_lock. num_reindeer
+ * is the size of the herd, and it changes as reindeer are hired and retired.
+ * the "last one back" threshold is team_size, or the whole herd if team_size
+ * is 0. each formed team remembers its size in team_sizes until santa gets
+ * to it; a reindeer is in at most one such team, so MAX_REINDEER is plenty. */
 static sem_t reindeer_counter_lock;
 static int num_reindeer_waiting = 0;
+static int num_reindeer = 0;
+static int team_size = TEAM_SIZE;
+static int num_teams_formed = 0;
+static int team_sizes[MAX_REINDEER];
+static unsigned long team_formed_ns[MAX_REINDEER];
+
+/* one semaphore per sleigh in the set; a sleigh's semaphore is unlocked while
+ * it's in the stable. team t always flies sleigh t % num_sleighs, and santa
+ * prepares teams in the order they formed. */
+static sem_set_t sleigh_set;
+static int num_sleighs = NUM_SLEIGHS;
+
+/* the teams that santa has prepared a sleigh for. reindeer in team t wait
+ * until the generation goes past t, which replaces signalling a counting
+ * semaphore once per reindeer as that would let one team steal another's
+ * signals. */
+static group_t teams_prepared;
+
+/* what the head santa is doing: sleeping, preparing a sleigh, or departed
+ * once the last delivery is done; and how many times he has been woken up. */
+static state_word_t santa_state;
+static unsigned long num_santa_wakeups = 0;
+
+/* a sleigh, and the team hitched to it; locked by reindeer_counter_lock. the
+ * team waits on landed to find out when the sleigh is back. */
+typedef struct {
+    int team;
+    int team_size;
+    int num_hitched;
+    unsigned long departed_ns;
+    group_t landed;
+} sleigh_t;
+
+static sleigh_t sleighs[MAX_SLEIGHS];
+
+/* how many sleighs have come back, and how many need to before it's over;
+ * locked by reindeer_counter_lock. */
+static int num_deliveries = 0;
+static int max_deliveries = NUM_DELIVERIES;
+static unsigned long flight_ns = 0;
+
+/* Everything that a regional santa and the elves in his region share. An elf
+ * with id i belongs to region i % num_regions. Only the head santa ever
+ * touches more than one region, and only to quiesce them all before the
+ * sleigh leaves. */
+typedef struct {
+    int id;
+
+    /* set of all semaphores (sem_t) in the region. */
+    sem_set_t sem_set;
+
+    /* what the regional santa is doing: sleeping, helping n elves that have
+     * yet to call get_help, or stopped by the head santa while he prepares a
+     * sleigh. */
+    state_word_t state;
+
+    /* mutex to keep track of whether or not the regional santa is currently
+     * asleep. */
+    sem_t sleep_mutex;
+
+    /* keep track of the region's elves lined up in an unordered way.  */
+    set_t elves_waiting;
+
+    /* the most recent group of elves that the regional santa helped. elves
+     * in line wait on the group's generation, which santa bumps when he
+     * publishes a new group; this replaces elf_line_set when GROUP_WAKE is
+     * set. */
+    group_t elf_group;
+
+    /* make sure that no more than elves_per_group elves line up at one
+     * time; starts off at elves_per_group and then decreases, when santa
+     * has helped out the elves it's signalled elves_per_group times. */
+    sem_t elf_counting_sem;
+
+    /* make sure that santa helping an elf is mutually exclusive from an elf
+     * getting in line to see santa. */
+    sem_t elf_mutex;
+
+    /* with oldest-first admission, none of the above three are used;
+     * instead every elf that needs help goes in here, santa takes the oldest
+     * elves, and the elf that makes a full group wakes santa up, as does
+     * santa himself if a full group is still waiting once he's done. */
+    pset_t elves_by_age;
+
+    /* with ticket admission, none of the above four are used; instead an
+     * elf takes the next ticket, and the elf that takes the last ticket of a
+     * group wakes santa up. santa serves tickets in order; the holder of
+     * each ticket that he hasn't served yet is kept as its id plus one in
+     * slot ticket % MAX_ELVES, which can't be reused before then as each elf
+     * holds at most one ticket. tickets are unsigned so that the slot is
+     * never negative, and long so that they don't wrap around in the middle
+     * of a group. */
+    unsigned long next_ticket;
+    unsigned long next_ticket_served;
+    int ticket_holders[MAX_ELVES];
+
+    /* how many elves in the group santa is helping have yet to be helped,
+     * which is only ever non-zero when santa was interrupted. only santa
+     * changes this, and only while his state says he's helping no one. */
+    int num_elves_left_in_group;
+
+    /* set by the regional santa when the reindeer interrupted him with elves
+     * left in the group, and cleared by the head santa, who wakes him up to
+     * finish the group once the sleigh has been prepared. */
+    int is_interrupted;
+
+    /* hired elves in this region that aren't retiring; locked by
+     * population_lock. */
+    int num_elves;
+
+    /* when the elf that last woke santa up signalled him, or 0 once santa
+     * has seen it. */
+    unsigned long woken_ns;
+
+    /* only touched by the regional santa. */
+    unsigned long num_groups_helped;
+    unsigned long num_wakeups;
+} region_t;
+
+static region_t regions[MAX_REGIONS];
+static int num_regions = NUM_REGIONS;
+
+/* when the simulation started, and how long the head santa spent waiting for
+ * every region to go quiet before preparing the sleigh. */
+static unsigned long start_ns = 0;
+static unsigned long quiesce_ns = 0;
+
+/* set by the head santa while a team is waiting for its sleigh; if preemption
+ * is on then this interrupts the regional santas. */
+static int preemption = PREEMPTION;
+static int sleigh_pending = 0;
+
+/* how long elves wait in line for help, how long a team waits between its
+ * last reindeer coming back and its sleigh being ready, and how long it takes
+ * a regional santa to wake up once an elf signals him. with the latency
+ * metric on, every semaphore wait and every hold of a set's lock is also
+ * recorded. */
+static hist_recorder_t elf_latency;
+static hist_recorder_t departure_latency;
+static hist_recorder_t wakeup_latency;
+static hist_recorder_t sem_wait_latency;
+static hist_recorder_t set_hold_latency;
+
+/* what the elves, santa, and the reindeer do between synchronizing. */
+static const workload_t *workload = NULL;
+
+/* the experiment being run. everything from here down to the results path
+ * can be set by a scenario file; see load_scenario. */
+static scenario_t scenario;
+
+typedef enum {
+    BACKEND_THREADS,
+    BACKEND_COROUTINES,
+    BACKEND_DES,
+    BACKEND_CORES
+} backend_t;
+
+typedef enum {
+    ADMISSION_SET,
+    ADMISSION_TICKETS,
+    ADMISSION_OLDEST
+} admission_t;
+
+typedef enum {
+    DELAY_UNIFORM,
+    DELAY_EXPONENTIAL,
+    DELAY_FIXED
+} delay_t;
+
+/* PLACEMENT_SPREAD pins the threads to the online cpus round-robin, in the
+ * order that they are started; PLACEMENT_ISOLATE_SANTA keeps the santas on
+ * cpu 0 and spreads the elves and reindeer over the rest. */
+typedef enum {
+    PLACEMENT_NONE,
+    PLACEMENT_SPREAD,
+    PLACEMENT_ISOLATE_SANTA
+} placement_t;
+
+enum {
+    METRIC_THROUGHPUT = 1 << 0,
+    METRIC_DELIVERIES = 1 << 1,
+    METRIC_LATENCY = 1 << 2,
+    METRIC_STATES = 1 << 3
+};
+
+/* settings that some backends don't support, as bits of a mask. */
+enum {
+    SETTING_WORKLOAD = 1 << 0,
+    SETTING_REGIONS = 1 << 1,
+    SETTING_ADMISSION = 1 << 2,
+    SETTING_DRAIN = 1 << 3,
+    SETTING_PREEMPTION = 1 << 4,
+    SETTING_TEAM_SIZE = 1 << 5,
+    SETTING_SLEIGHS = 1 << 6,
+    SETTING_DELIVERIES = 1 << 7,
+    SETTING_MAX_WAIT = 1 << 8,
+    SETTING_MAX_HELP = 1 << 9,
+    SETTING_WAIT_DELAY = 1 << 10,
+    SETTING_HELP_DELAY = 1 << 11,
+    SETTING_DURATION = 1 << 12,
+    SETTING_PLACEMENT = 1 << 13,
+    SETTING_WATCHDOG = 1 << 14,
+    SETTING_SAMPLE_FILE = 1 << 15,
+    SETTING_PROFILE_FILE = 1 << 16,
+
+    /* only the threads have regions, admission, sleighs, and the like, pin
+     * their threads where they're told, or have the watchdog, sampler, and
+     * profiler look at them. */
+    SETTINGS_THREADS_ONLY = SETTING_REGIONS | SETTING_ADMISSION
+                          | SETTING_DRAIN | SETTING_PREEMPTION
+                          | SETTING_TEAM_SIZE | SETTING_SLEIGHS
+                          | SETTING_WAIT_DELAY | SETTING_HELP_DELAY
+                          | SETTING_PLACEMENT | SETTING_WATCHDOG
+                          | SETTING_SAMPLE_FILE | SETTING_PROFILE_FILE,
+
+    /* virtual time has its own delay ranges and end time; see des.h. the
+     * coroutines yield instead of waiting, and stop after one delivery. */
+    SETTINGS_REAL_TIME = SETTING_DELIVERIES | SETTING_MAX_WAIT
+                       | SETTING_MAX_HELP | SETTING_DURATION
+};
+
+/* the settings that each backend doesn't support, by backend_t. */
+static const int unsupported_settings[] = {
+    0,
+    SETTINGS_THREADS_ONLY | SETTINGS_REAL_TIME | SETTING_WORKLOAD,
+    SETTINGS_THREADS_ONLY | SETTINGS_REAL_TIME,
+    SETTINGS_THREADS_ONLY
+};
+
+static const char *setting_names[] = {
+    "workload", "regions", "admission", "drain", "preemption", "team_size",
+    "sleighs", "deliveries", "max_wait", "max_help", "wait_delay",
+    "help_delay", "duration", "placement", "watchdog", "sample_file",
+    "profile_file", NULL
+};
+
+static const char *backend_names[] = {
+    "threads", "coroutines", "des", "cores", NULL
+};
+static const char *admission_names[] = {"set", "tickets", "oldest", NULL};
+static const char *delay_names[] = {"uniform", "exponential", "fixed", NULL};
+static const char *placement_names[] = {
+    "none", "spread", "isolate-santa", NULL
+};
+static const char *metric_names[] = {
+    "throughput", "deliveries", "latency", "states", NULL
+};
+
+static backend_t backend = BACKEND_THREADS;
+static int num_executors = 0;
+static int num_initial_elves = NUM_ELVES;
+static int num_initial_reindeer = NUM_REINDEER;
+static int elves_per_group = NUM_ELVES_PER_GROUP;
+static admission_t admission = ADMISSION;
+static int drain = DRAIN;
+static int max_wait_time = MAX_WAIT_TIME;
+static int max_help_time = MAX_HELP_TIME;
+static delay_t wait_delay = WAIT_DELAY;
+static delay_t help_delay = HELP_DELAY;
+static placement_t placement = PLACEMENT;
+static int metrics = METRICS;
+static int duration = DURATION;
+static unsigned int seed = 0;
+static const char *workload_name = WORKLOAD;
+static int quiet = QUIET;
+static int watchdog_stall_ms = WATCHDOG_STALL_MS;
+static const char *sample_path = NULL;
+static int sample_period_us = SAMPLE_PERIOD_US;
+static const char *profile_path = NULL;
+static int profile_period_us = PROFILE_PERIOD_US;
+static int profile_depth = PROFILE_DEPTH;
+
+/* when the process started, or for a forked experiment, when it was forked,
+ * and how long it took from then until every thread had been started. */
+static unsigned long launch_ns = 0;
+static unsigned long setup_ns = 0;
+static const char *program_name = "santaclaus";
+
+/* where a forked experiment reports its setup time back to the fork server;
+ * NULL if this process isn't a forked experiment. */
+static unsigned long *experiment_setup_ns = NULL;
+
+/* name of the workload that has been loaded, if any. */
+static const char *loaded_workload_name = NULL;
+
+/* stdout's buffer, so that it isn't allocated by the first printf. */
+static char stdout_buffer[BUFSIZ];
+
+static const char *results_path = NULL;
+static int next_cpu = 0;
+
+/* the state of each elf and reindeer slot; an elf or reindeer thread owns its
+ * slot while it's hired. retiring an actor only marks its slot, the actor
+ * itself notices this at a safe point and then frees the slot. the elf slots
+ * and num_elves are locked by population_lock, the reindeer slots are locked
+ * by reindeer_counter_lock as they are bound up with the threshold. */
+typedef enum {
+    SLOT_FREE,
+    SLOT_HIRED,
+    SLOT_RETIRING,
+    SLOT_COMMITTED /* reindeer is back; too late to retire it */
+} slot_state_t;
+
+static sem_t population_lock;
+static slot_state_t elf_slots[MAX_ELVES];
+static slot_state_t reindeer_slots[MAX_REINDEER];
+static int num_elves = 0; /* hired elves that aren't retiring */
+
+/* ids passed to each actor thread; these must outlive the threads. */
+static int actor_ids[MAX(MAX_ELVES, MAX_REINDEER)];
 
-/* keep track of the elves lined up in an unordered way.  */
-static set_t elves_waiting;
+/**
+ * Get the watchdog heartbeat slot of an actor. The head santa is slot 0, then
+ * come the regional santas, the elves, and the reindeer.
+ */
+static int heartbeat_slot(const trace_actor_t actor, const int id) {
+    switch(actor) {
+    case TRACE_SANTA:
+        return 1 + id;
+    case TRACE_ELF:
+        return 1 + MAX_REGIONS + id;
+    default:
+        return 1 + MAX_REGIONS + MAX_ELVES + id;
+    }
+}
 
-/* make sure that no more than NUM_ELVES_PER_GROUP elves line up at one time;
- * starts off at NUM_ELVES_PER_GROUP and then decreases, when santa has helped
- * out the elves it's signalled NUM_ELVES_PER_GROUP times. */
-static sem_t elf_counting_sem;
+#define NUM_HEARTBEAT_SLOTS (1 + MAX_REGIONS + MAX_ELVES + MAX_REINDEER)
 
-/* make sure that santa helping an elf is mutually exclusive from an elf
- * getting in line to see santa. */
-static sem_t elf_mutex;
+/**
+ * Note that an actor has moved to a new state: beat its heartbeat, trace the
+ * event, and attribute the thread's CPU time to the new state from now on.
+ * This must be called from the actor's own thread.
+ */
+static void actor_event(const trace_actor_t actor,
+                        const int id,
+                        const trace_event_t event,
+                        const int arg) {
+    watchdog_beat(heartbeat_slot(actor, id), event);
+    trace_event(actor, id, event, arg);
+    prof_enter(actor, event);
+}
 
-/* keep track of how many of the NUM_ELVES_PER_GROUP lined up elves have been
- * helped by santa; locked by elf_counter_lock. */
-static sem_t elf_counter_lock;
-static int num_elves_being_helped = 0;
+/**
+ * Get a random amount of time to wait, in approx. cycles, of at most some
+ * max time. Exponential and fixed delays have the same mean as uniform ones.
+ */
+static unsigned int random_delay(const delay_t delay, const int max_time) {
+    double u;
+
+    switch(delay) {
+    case DELAY_EXPONENTIAL:
+        u = (rand() + 1.0) / (RAND_MAX + 2.0);
+        u = -0.5 * max_time * log(u);
+        return u < max_time ? (unsigned int) u : (unsigned int) max_time;
+    case DELAY_FIXED:
+        return (unsigned int) (max_time / 2);
+    default:
+        return (unsigned int) (rand() % max_time);
+    }
+}
 
 /**
- * Busy wait for an arbitrary amount of time. Before waiting, print out a
- * message to standard output. The message must contain one integer formatting
- * variable.
+ * Run one of the workload's operations for an arbitrary amount of time.
+ * Before waiting, print out a message to standard output. The message must
+ * contain one integer formatting variable.
  *
- * Params: - Message to print
- *         - Integer to substitute into the message
+ * Params: - Workload operation to run; may be NULL
+ *         - Message to print
+ *         - Integer to substitute into the message, also passed along to the
+ *           workload as the actor's id
  */
-static void random_wait(const char *message, const int format_var) {
-    unsigned int i = rand() % MAX_WAIT_TIME;
-    fprintf(stdout, message, format_var);
-    if(OBSERVABLE_DELAYS) {
-        for(; --i; ) /* ho ho ho! */;
+static void random_wait(void (*op)(const int, const unsigned int),
+                        const char *message,
+                        const int format_var) {
+    unsigned int i = random_delay(wait_delay, max_wait_time);
+    LOG_DEBUG((message, format_var));
+    if(OBSERVABLE_DELAYS && NULL != op) {
+        op(format_var, i);
     }
 }
 
@@ -152,76 +628,337 @@ static void random_wait(const char *message, const int format_var) {
  */
 
 /**
- * Have santa help the elves; function required in problem specifications.
+ * Take up the amount of time it takes santa to help an elf.
  */
-static void help_elves(void) {
-    int i;
+static void help_wait(const int elf) {
+    unsigned int i = random_delay(help_delay, max_help_time);
+    if(OBSERVABLE_DELAYS && NULL != workload->help) {
+        workload->help(elf, i);
+    }
+}
+
+/**
+ * Get the number of elves waiting in a region's line.
+ */
+static int num_elves_in_line(region_t *region) {
+    if(ADMISSION_TICKETS == admission) {
+        return (int) (__atomic_load_n(&(region->next_ticket), __ATOMIC_ACQUIRE)
+                    - region->next_ticket_served);
+    } else if(ADMISSION_OLDEST == admission) {
+        return pset_cardinality(region->elves_by_age);
+    }
+    return set_cardinality(region->elves_waiting);
+}
+
+/**
+ * Take the next elf out of a region's line. With tickets, this is whoever
+ * holds the oldest ticket that hasn't been served; its holder may have taken
+ * the ticket but not yet written down its id.
+ */
+static int next_elf_in_line(region_t *region) {
+    int *holder;
     int elf;
 
-    fprintf(stdout, "Santa: noticed that there are elves waiting! \n");
+    if(ADMISSION_SET == admission) {
+        return set_take(region->elves_waiting);
+    } else if(ADMISSION_OLDEST == admission) {
+        return pset_take(region->elves_by_age);
+    }
 
-    sem_wait(santa_busy_mutex);
-    CRITICAL(elf_counter_lock, {
-        num_elves_being_helped = NUM_ELVES_PER_GROUP;
-    });
+    holder = &(region->ticket_holders[region->next_ticket_served % MAX_ELVES]);
+    while(!(elf = __atomic_load_n(holder, __ATOMIC_ACQUIRE))) {
+        sched_yield();
+    }
+    *holder = 0;
+    ++(region->next_ticket_served);
+    return elf - 1;
+}
+
+/**
+ * Help up to the rest of the current group of elves, one at a time.
+ *
+ * Returns: the number of elves helped, which is less than the number left in
+ *          the group only if santa was interrupted by the reindeer.
+ */
+static int help_group(region_t *region, int *group) {
+    int num_taken = 0;
+    int i;
+    int elf;
 
-    /* help the elves */
-    CRITICAL(elf_mutex, {
+    LOG_INFO(("Santa %d: There are %d elves outside my door! \n",
+        region->id,
+        num_elves_in_line(region)
+    ));
 
-        fprintf(stdout,
-            "Santa: There are %d elves outside my door! \n",
-            set_cardinality(elves_waiting)
+    /* nothing can interrupt santa, so take the oldest elves all at once. */
+    if(ADMISSION_OLDEST == admission && !preemption) {
+        num_taken = pset_take_oldest(
+            region->elves_by_age, group, region->num_elves_left_in_group
         );
+        assert(num_taken == region->num_elves_left_in_group);
+    }
 
-        for(i = 0; i < NUM_ELVES_PER_GROUP; ++i) {
-            elf = set_take(elves_waiting);
-            fprintf(stdout, "Santa: helping elf: %d. \n", elf);
-            sem_signal_index(&elf_line_set, elf, 1);
+    for(i = 0; i < region->num_elves_left_in_group; ++i) {
+        if(preemption && __atomic_load_n(&sleigh_pending, __ATOMIC_ACQUIRE)) {
+            LOG_INFO(("Santa %d: the reindeer need me! \n", region->id));
+            break;
         }
-    });
+
+        elf = i < num_taken ? group[i] : next_elf_in_line(region);
+        LOG_DEBUG(("Santa %d: helping elf: %d. \n", region->id, elf));
+        actor_event(TRACE_SANTA, region->id, TRACE_HELPING_ELF, elf);
+        help_wait(elf);
+        group[i] = elf;
+    }
+
+    return i;
+}
+
+/**
+ * Have santa help the elves; function required in problem specifications.
+ * Santa helps however many elves are left in the group one at a time, and
+ * then lets them all go at once. With preemption on, a waiting team of
+ * reindeer makes santa stop between elves; the elves he hasn't gotten to yet
+ * stay at the front of the line, as no new elves can line up until the whole
+ * group has been helped, or, with tickets, as they hold the oldest tickets.
+ */
+static void help_elves(region_t *region) {
+    int i;
+    int group[MAX_ELVES_PER_GROUP];
+    int num_helped = 0;
+
+    LOG_DEBUG(("Santa %d: noticed that there are elves waiting! \n",
+        region->id
+    ));
+
+    state_acquire(
+        &(region->state), STATE_SLEEPING, STATE_WORD(STATE_HELPING, 0)
+    );
+
+    /* help the elves; only the set needs to keep elves out of line. */
+    if(ADMISSION_SET != admission) {
+        num_helped = help_group(region, &(group[0]));
+    } else {
+        CRITICAL(region->elf_mutex, {
+            num_helped = help_group(region, &(group[0]));
+        });
+    }
+
+    region->num_elves_left_in_group -= num_helped;
+
+    /* the reindeer are about to be given the sleigh, so waking up again now
+     * would only see them still waiting; leave it to the head santa to wake
+     * him up once they're gone. this has to happen before santa can go back
+     * to sleep, as that's what lets the head santa prepare the sleigh. */
+    if(region->num_elves_left_in_group) {
+        __atomic_store_n(&(region->is_interrupted), 1, __ATOMIC_RELEASE);
+    }
+
+    /* the last of the helped elves to call get_help lets santa go back to
+     * sleep; if he was interrupted before anyone was helped, nobody will. */
+    state_cas(&(region->state),
+        STATE_WORD(STATE_HELPING, 0),
+        num_helped ? STATE_WORD(STATE_HELPING, num_helped)
+                   : STATE_WORD(STATE_SLEEPING, 0)
+    );
+
+    if(!region->num_elves_left_in_group) {
+        ++(region->num_groups_helped);
+
+        /* nobody else will wake santa for a full group that was already
+         * waiting behind this one. */
+        if(ADMISSION_OLDEST == admission
+        && elves_per_group <= num_elves_in_line(region)) {
+            sem_signal(region->sleep_mutex);
+        }
+    }
+
+    /* wake up the helped elves, ideally all at once; if santa was
+     * interrupted before helping anyone then there's nobody to wake. */
+    if(!num_helped) {
+        return;
+    } else if(GROUP_WAKE || ADMISSION_SET != admission) {
+        group_publish(&(region->elf_group), &(group[0]), num_helped);
+    } else {
+        for(i = 0; i < num_helped; ++i) {
+            sem_signal_index(&elf_line_set, group[i], 1);
+        }
+    }
 }
 
 /**
  * Prepare the sleigh for the reindeer; function required by problem
- * specification. Make santa busy (thus blocking elves and sleep) and signal
- * that reindeer can start hitching onto the sleigh.
+ * specification. Wait for the team's sleigh to be in the stable, make every
+ * regional santa busy (thus blocking elves and sleep) while the sleigh is
+ * prepared, and then signal that the team can start hitching onto it.
+ */
+static void prepare_sleigh(const int team) {
+    sleigh_t *sleigh = &(sleighs[team % num_sleighs]);
+    unsigned long quiesce_start;
+    int i;
+
+    sem_wait_index(&sleigh_set, team % num_sleighs);
+    state_cas(&santa_state,
+        STATE_WORD(STATE_SLEEPING, 0), STATE_WORD(STATE_PREPARING, 0)
+    );
+
+    quiesce_start = clock_ns();
+    __atomic_store_n(&sleigh_pending, 1, __ATOMIC_RELEASE);
+    for(i = 0; i < num_regions; ++i) {
+        state_acquire(&(regions[i].state),
+            STATE_SLEEPING, STATE_WORD(STATE_PREPARING, 0)
+        );
+    }
+    quiesce_ns += clock_ns() - quiesce_start;
+
+    CRITICAL(reindeer_counter_lock, {
+        sleigh->team = team;
+        sleigh->team_size = team_sizes[team % MAX_REINDEER];
+        sleigh->num_hitched = 0;
+    });
+
+    LOG_INFO(("Santa: preparing sleigh %d for team %d. \n",
+        team % num_sleighs, team
+    ));
+    actor_event(TRACE_SANTA, -1, TRACE_PREPARING_SLEIGH, team);
+    hist_record(
+        &departure_latency, clock_ns() - team_formed_ns[team % MAX_REINDEER]
+    );
+    group_publish(&teams_prepared, NULL, 0);
+    __atomic_store_n(&sleigh_pending, 0, __ATOMIC_RELEASE);
+
+    for(i = 0; i < num_regions; ++i) {
+        state_cas(&(regions[i].state),
+            STATE_WORD(STATE_PREPARING, 0), STATE_WORD(STATE_SLEEPING, 0)
+        );
+
+        /* send the interrupted santas back to the rest of their groups. */
+        if(__atomic_exchange_n(&(regions[i].is_interrupted), 0,
+                               __ATOMIC_ACQ_REL)) {
+            sem_signal(regions[i].sleep_mutex);
+        }
+    }
+    state_cas(&santa_state,
+        STATE_WORD(STATE_PREPARING, 0), STATE_WORD(STATE_SLEEPING, 0)
+    );
+}
+
+/**
+ * Record how long it took a regional santa to wake up after an elf signalled
+ * him, if one did; the head santa also signals him after interrupting him.
+ */
+static void record_wakeup(region_t *region) {
+    const unsigned long woken_ns =
+        __atomic_load_n(&(region->woken_ns), __ATOMIC_RELAXED);
+    if(woken_ns) {
+        hist_record(&wakeup_latency, clock_ns() - woken_ns);
+        __atomic_store_n(&(region->woken_ns), 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Check whether or not a regional santa has a group of elves to help, either
+ * the rest of a group that he was interrupted in the middle of, or a full
+ * group that's waiting in line.
+ */
+static int group_ready(region_t *region) {
+    return region->num_elves_left_in_group
+        || elves_per_group <= num_elves_in_line(region);
+}
+
+/**
+ * Help the next group of elves, if there is one.
  */
-static void prepare_sleigh(void) {
-    sem_wait(santa_busy_mutex);
-    fprintf(stdout, "Santa: preparing the sleigh. \n");
-    sem_signal_ntimes(reindeer_counting_sem, NUM_REINDEER);
+static void serve_group(region_t *region) {
+    if(!group_ready(region)) {
+        return;
+    }
+    if(!region->num_elves_left_in_group) {
+        region->num_elves_left_in_group = elves_per_group;
+    }
+    help_elves(region);
+}
+
+/**
+ * Regional santa thread; one per region. Every full group of elves signals
+ * the sleep mutex once, so when draining, santa takes the signal of each
+ * group that he serves without sleeping, if it has been made yet; a signal
+ * that comes in late just costs an empty wakeup.
+ */
+static void *regional_santa(void *region_ptr) {
+    region_t *region = (region_t *) region_ptr;
+
+    while(1) {
+
+        /* wait until santa isn't busy to continue, i.e. helping elves or
+         * stopped by the head santa while he prepares a sleigh. */
+        state_wait_for(&(region->state), STATE_SLEEPING);
+        LOG_DEBUG(("Santa %d: zzZZzZzzzZZzzz (sleeping) \n", region->id));
+        actor_event(TRACE_SANTA, region->id, TRACE_SLEEPING, 0);
+
+        sem_wait(region->sleep_mutex);
+        ++(region->num_wakeups);
+        record_wakeup(region);
+
+        LOG_DEBUG(("Santa %d: I'm up, I'm up! Whaddya want? \n",
+            region->id
+        ));
+        actor_event(TRACE_SANTA, region->id, TRACE_WOKEN, 0);
+
+        serve_group(region);
+
+        /* the head santa can't prepare a sleigh while this santa is busy, so
+         * draining always stops for the reindeer. */
+        while(drain
+        && !__atomic_load_n(&sleigh_pending, __ATOMIC_ACQUIRE)
+        && group_ready(region)) {
+            sem_try_wait(region->sleep_mutex);
+            __atomic_store_n(&(region->woken_ns), 0, __ATOMIC_RELAXED);
+            serve_group(region);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get the number of teams that have formed.
+ */
+static int teams_formed(void) {
+    int num_teams_ready = 0;
+    CRITICAL(reindeer_counter_lock, {
+        num_teams_ready = num_teams_formed;
+    });
+    return num_teams_ready;
 }
 
 /**
- * Santa thread. Note: do not launch more than one!
+ * Head santa thread. Note: do not launch more than one! Each time the last
+ * reindeer of a team wakes santa up he prepares the next team's sleigh, or,
+ * when draining, every team that is ready.
  */
 static void *santa(void *_) {
     static int num_launched = 0;
+    int num_teams_prepared = 0;
 
     assert(1 == ++num_launched);
 
     while(1) {
 
-        /* wait until santa isn't busy to continue */
-        CRITICAL(santa_busy_mutex, {
-            fprintf(stdout, "Santa: zzZZzZzzzZZzzz (sleeping) \n");
-        });
+        LOG_DEBUG(("Santa: zzZZzZzzzZZzzz (sleeping) \n"));
+        actor_event(TRACE_SANTA, -1, TRACE_SLEEPING, 0);
 
         sem_wait(santa_sleep_mutex);
+        ++num_santa_wakeups;
 
-        fprintf(stdout, "Santa: I'm up, I'm up! Whaddya want? \n");
-
-        if(NUM_REINDEER <= num_reindeer_waiting) {
+        LOG_DEBUG(("Santa: I'm up, I'm up! Whaddya want? \n"));
+        actor_event(TRACE_SANTA, -1, TRACE_WOKEN, 0);
 
-            num_reindeer_waiting = NUM_REINDEER;
-            prepare_sleigh();
-
-            /* completely lock santa; It's time to deliver presents! */
-            sem_wait(santa_busy_mutex);
-            sem_wait(santa_sleep_mutex);
-
-        } else if(3 <= set_cardinality(elves_waiting)) {
-            help_elves();
+        if(num_teams_prepared < teams_formed()) {
+            prepare_sleigh(num_teams_prepared++);
+            while(drain && num_teams_prepared < teams_formed()) {
+                sem_try_wait(santa_sleep_mutex);
+                prepare_sleigh(num_teams_prepared++);
+            }
         }
     }
     return NULL;
@@ -236,49 +973,208 @@ static void *santa(void *_) {
 /**
  * Get help from santa; function required in problem specifications.
  */
-static void get_help(const int id) {
-    fprintf(stdout, "Elf %d got santa's help! \n", id);
+static void get_help(region_t *region, const int id) {
+    /* santa can't change this until he's back to sleep, which is after
+     * this elf is done with him. */
+    const int num_left_in_group = region->num_elves_left_in_group;
+    int word;
+
+    LOG_DEBUG(("Elf %d got santa's help! \n", id));
+
+    /* count off this elf; the last one lets santa go back to sleep. */
+    do {
+        word = state_load(&(region->state));
+        if(STATE_HELPING != STATE_OF(word)) {
+            return; /* santa has departed */
+        }
+    } while(!state_cas(&(region->state), word,
+        1 < STATE_COUNT(word) ? STATE_WORD(STATE_HELPING, STATE_COUNT(word) - 1)
+                              : STATE_WORD(STATE_SLEEPING, 0)
+    ));
+
+    /* signal that elves can line up again if the whole group has been
+     * helped */
+    if(1 == STATE_COUNT(word) && !num_left_in_group
+    && ADMISSION_SET == admission) {
+        sem_signal_ntimes(region->elf_counting_sem, elves_per_group);
+    }
+}
 
-    CRITICAL(elf_counter_lock, {
-        --num_elves_being_helped;
+/**
+ * Check whether or not an elf has been retired. If so, free up its slot so
+ * that it can be hired again. Elves only check this between visits to santa
+ * so that a retiring elf never leaves a group short.
+ */
+static int elf_retired(const int id) {
+    int retired = 0;
 
-        /* unlock santa; signal that elves can line up again */
-        if(!num_elves_being_helped) {
-            sem_signal(santa_busy_mutex);
-            sem_signal_ntimes(elf_counting_sem, NUM_ELVES_PER_GROUP);
+    CRITICAL(population_lock, {
+        if(SLOT_RETIRING == elf_slots[id]) {
+            elf_slots[id] = SLOT_FREE;
+            retired = 1;
         }
     });
+
+    return retired;
 }
 
 /**
- * A single elf thread.
+ * Get in line for santa's help by joining the set of waiting elves. The elf
+ * that makes a full group wakes santa up.
+ *
+ * Params: - The elf's region.
+ *         - The elf's id.
+ *         - Where to put the time at which the elf got in line.
+ *
+ * Returns: the generation of the region's elf group to wait past.
  */
-static void *elf(void *elf_id) {
-    const int id = *((int *) elf_id);
+static int join_line(region_t *region,
+                     const int id,
+                     unsigned long *in_line_ns) {
+    int generation = 0;
+
+    /* we need to make sure that if there are three elves waiting that we
+     * don't go into the waiting line until those three elves are done. */
+    sem_wait(region->elf_counting_sem);
+
+    CRITICAL(region->elf_mutex, {
+        *in_line_ns = clock_ns();
+        generation = group_generation(&(region->elf_group));
+        set_insert(region->elves_waiting, id);
+        LOG_DEBUG(("Elf %d in line for santa %d's help. \n",
+            id, region->id
+        ));
+        actor_event(TRACE_ELF, id, TRACE_IN_LINE, region->id);
+
+        /* wake up santa */
+        if(elves_per_group == set_cardinality(region->elves_waiting)) {
+            LOG_INFO(("Elves: waking up santa %d! \n", region->id));
+            __atomic_store_n(&(region->woken_ns), clock_ns(), __ATOMIC_RELAXED);
+            sem_signal(region->sleep_mutex);
+        }
+    });
 
-    while(1) {
-        random_wait("Elf %d is working... \n", id);
-        fprintf(stdout, "Elf %d needs Santa's help. \n", id);
+    return generation;
+}
 
-        /* we need to make sure that if there are three elves waiting that we
-         * don't go into the waiting line until those three elves are done. */
-        sem_wait(elf_counting_sem);
+/**
+ * Get in line for santa's help by taking the next ticket. The elf's group is
+ * its ticket divided by the group size, and the elf with the last ticket of a
+ * group wakes santa up; there is no lock, and the line is first-come
+ * first-served.
+ *
+ * Params: - The elf's region.
+ *         - The elf's id.
+ *         - Where to put the time at which the elf got in line.
+ *
+ * Returns: the generation of the region's elf group to wait past.
+ */
+static int take_ticket(region_t *region,
+                       const int id,
+                       unsigned long *in_line_ns) {
+    int generation;
+    unsigned long ticket;
+
+    /* the generation has to be read before santa can possibly see the
+     * ticket, or else the elf could miss its own group. */
+    *in_line_ns = clock_ns();
+    generation = group_generation(&(region->elf_group));
+    ticket = __sync_fetch_and_add(&(region->next_ticket), 1UL);
+
+    __atomic_store_n(
+        &(region->ticket_holders[ticket % MAX_ELVES]), id + 1, __ATOMIC_RELEASE
+    );
+    LOG_DEBUG(("Elf %d in line for santa %d's help in group %lu. \n",
+        id, region->id, ticket / (unsigned long) elves_per_group
+    ));
+    actor_event(TRACE_ELF, id, TRACE_IN_LINE, region->id);
+
+    if((unsigned long) elves_per_group - 1
+    == ticket % (unsigned long) elves_per_group) {
+        LOG_INFO(("Elves: waking up santa %d! \n", region->id));
+        __atomic_store_n(&(region->woken_ns), clock_ns(), __ATOMIC_RELAXED);
+        sem_signal(region->sleep_mutex);
+    }
 
-        CRITICAL(elf_mutex, {
-            set_insert(elves_waiting, id);
-            fprintf(stdout, "Elf %d in line for santa's help. \n", id);
+    return generation;
+}
 
-            /* wake up santa */
-            if(NUM_ELVES_PER_GROUP == set_cardinality(elves_waiting)) {
-                fprintf(stdout, "Elves: waking up santa! \n");
-                sem_signal(santa_sleep_mutex);
-            }
-        });
+/**
+ * Get in line for santa's help by going into the priority set, where the
+ * elves that have waited longest are helped first. The elf that makes a full
+ * group wakes santa up.
+ *
+ * Params: - The elf's region.
+ *         - The elf's id.
+ *         - Where to put the time at which the elf got in line.
+ *
+ * Returns: the generation of the region's elf group to wait past.
+ */
+static int join_queue(region_t *region,
+                      const int id,
+                      unsigned long *in_line_ns) {
+    int generation;
+
+    /* as with tickets, the generation has to be read before santa can
+     * possibly take the elf. */
+    *in_line_ns = clock_ns();
+    generation = group_generation(&(region->elf_group));
+
+    LOG_DEBUG(("Elf %d in line for santa %d's help. \n", id, region->id));
+    actor_event(TRACE_ELF, id, TRACE_IN_LINE, region->id);
+    if(elves_per_group == pset_insert(region->elves_by_age, id)) {
+        LOG_INFO(("Elves: waking up santa %d! \n", region->id));
+        __atomic_store_n(&(region->woken_ns), clock_ns(), __ATOMIC_RELAXED);
+        sem_signal(region->sleep_mutex);
+    }
+
+    return generation;
+}
+
+/**
+ * A single elf thread.
+ */
+static void *elf(void *elf_id) {
+    const int id = *((int *) elf_id);
+    region_t *region = &(regions[id % num_regions]);
+    int generation = 0;
+    int position = 0;
+    unsigned long in_line_ns = 0;
+
+    while(!elf_retired(id)) {
+        actor_event(TRACE_ELF, id, TRACE_WORKING, 0);
+        random_wait(workload->work, "Elf %d is working... \n", id);
+        LOG_DEBUG(("Elf %d needs Santa's help. \n", id));
+        actor_event(TRACE_ELF, id, TRACE_NEEDS_HELP, 0);
+
+        if(ADMISSION_TICKETS == admission) {
+            generation = take_ticket(region, id, &in_line_ns);
+        } else if(ADMISSION_OLDEST == admission) {
+            generation = join_queue(region, id, &in_line_ns);
+        } else {
+            generation = join_line(region, id, &in_line_ns);
+        }
 
-        sem_wait_index(&elf_line_set, id);
-        get_help(id);
+        if(GROUP_WAKE || ADMISSION_SET != admission) {
+            position = group_wait(&(region->elf_group), id, generation);
+            LOG_DEBUG(("Elf %d is number %d in santa's group. \n",
+                id, 1 + position
+            ));
+        } else {
+            sem_wait_index(&elf_line_set, id);
+        }
+
+        hist_record(&elf_latency, clock_ns() - in_line_ns);
+        actor_event(TRACE_ELF, id, TRACE_GOT_HELP, position);
+        get_help(region, id);
     }
 
+    LOG_INFO(("Elf %d has retired. \n", id));
+    actor_event(TRACE_ELF, id, TRACE_RETIRED, 0);
+
+    /* the thread library frees things when a thread exits; retiring was
+     * asked for by the control thread, so that's on its account. */
+    alloc_thread_phase(ALLOC_PHASE_CONTROL);
     return NULL;
 }
 
@@ -292,7 +1188,67 @@ static void *elf(void *elf_id) {
  * Have a reindeer get hitched; function required by problem specifications.
  */
 static void get_hitched(const int id) {
-    fprintf(stdout, "Reindeer %d is getting hitched to the sleigh! \n", id);
+    LOG_DEBUG(("Reindeer %d is getting hitched to the sleigh! \n", id));
+    actor_event(TRACE_REINDEER, id, TRACE_HITCHED, 0);
+}
+
+/**
+ * Get the number of reindeer that the team being formed needs.
+ */
+static int team_threshold(void) {
+    return team_size ? team_size : num_reindeer;
+}
+
+/**
+ * Finish forming the current team if it has enough reindeer. This must be
+ * called with reindeer_counter_lock held.
+ *
+ * Returns: 1 if a team was formed and so santa needs to be woken up.
+ */
+static int form_team(void) {
+    if(num_reindeer_waiting < team_threshold()) {
+        return 0;
+    }
+
+    team_sizes[num_teams_formed % MAX_REINDEER] = num_reindeer_waiting;
+    team_formed_ns[num_teams_formed % MAX_REINDEER] = clock_ns();
+    ++num_teams_formed;
+    num_reindeer_waiting = 0;
+    return 1;
+}
+
+/**
+ * Have the last reindeer hitched fly the sleigh, and bring it back to the
+ * stable once the presents have been delivered.
+ */
+static void deliver_presents(const int id, sleigh_t *sleigh) {
+    const int sleigh_id = (int) (sleigh - &(sleighs[0]));
+    int is_done = 0;
+    int i;
+
+    LOG_INFO(("Santa: Ho ho ho! Off to deliver presents! \n"));
+    actor_event(TRACE_REINDEER, id, TRACE_DEPARTED, sleigh_id);
+    random_wait(
+        workload->vacation, "Sleigh %d is out delivering presents... \n",
+        sleigh_id
+    );
+
+    CRITICAL(reindeer_counter_lock, {
+        flight_ns += clock_ns() - sleigh->departed_ns;
+        is_done = (++num_deliveries == max_deliveries);
+    });
+
+    LOG_INFO(("Sleigh %d is back in the stable. \n", sleigh_id));
+    if(is_done) {
+        state_store(&santa_state, STATE_WORD(STATE_DEPARTED, 0));
+        for(i = 0; i < num_regions; ++i) {
+            state_store(&(regions[i].state), STATE_WORD(STATE_DEPARTED, 0));
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    group_publish(&(sleigh->landed), NULL, 0);
+    sem_signal_index(&sleigh_set, sleigh_id, 1);
 }
 
 /**
@@ -300,127 +1256,1266 @@ static void get_hitched(const int id) {
  */
 static void *reindeer(void *reindeer_id) {
     const int id = *((int *) reindeer_id);
+    sleigh_t *sleigh;
+    int is_last = 0;
+    int is_retired = 0;
+    int is_driver = 0;
+    int landed = 0;
+    int team = 0;
+
+    while(1) {
 
-    /* have the reindeer go on vacation for an arbitrary amount of time and
-     * then come back and wait for the other reindeer to return. */
-    random_wait("Reindeer %d is off to the Tropics! \n", id);
+        /* have the reindeer go on vacation for an arbitrary amount of time
+         * and then come back and wait for the rest of its team to return. */
+        actor_event(TRACE_REINDEER, id, TRACE_VACATION, 0);
+        random_wait(workload->vacation, "Reindeer %d is off to the Tropics! \n", id);
+
+        /* a reindeer retired while on vacation never comes back. */
+        CRITICAL(reindeer_counter_lock, {
+            if(SLOT_RETIRING == reindeer_slots[id]) {
+                reindeer_slots[id] = SLOT_FREE;
+                is_retired = 1;
+            } else {
+                reindeer_slots[id] = SLOT_COMMITTED;
+                team = num_teams_formed;
+                ++num_reindeer_waiting;
+                is_last = form_team();
+            }
+        });
 
-    CRITICAL(reindeer_counter_lock, {
-        ++num_reindeer_waiting;
-    });
+        if(is_retired) {
+            LOG_INFO(("Reindeer %d has retired in the Tropics.\n", id));
+            actor_event(TRACE_REINDEER, id, TRACE_RETIRED, 0);
+            alloc_thread_phase(ALLOC_PHASE_CONTROL);
+            return NULL;
+        }
 
-    fprintf(stdout, "Reindeer %d is back from the Tropics.\n", id);
+        LOG_DEBUG(("Reindeer %d is back from the Tropics.\n", id));
+        actor_event(TRACE_REINDEER, id, TRACE_BACK, is_last);
 
-    if(NUM_REINDEER <= num_reindeer_waiting) {
-        fprintf(stdout, "Reindeer %d: I'm the last one; I'll get santa!\n", id);
-        sem_signal(santa_sleep_mutex);
-    }
+        if(is_last) {
+            LOG_INFO((
+                "Reindeer %d: I'm the last one in team %d; I'll get santa!\n",
+                id, team
+            ));
+            sem_signal(santa_sleep_mutex);
+        }
 
-    /* santa is awake, now wait for him to tell us to get hitched */
-    sem_wait(reindeer_counting_sem);
+        /* santa is awake, now wait for him to tell us to get hitched */
+        group_wait_past(&teams_prepared, team);
+        sleigh = &(sleighs[team % num_sleighs]);
 
-    /* the sleigh has been prepared, time to get hitched and go! */
-    CRITICAL(reindeer_counter_lock, {
+        /* the sleigh has been prepared, time to get hitched and go! */
+        CRITICAL(reindeer_counter_lock, {
+            get_hitched(id);
+            landed = group_generation(&(sleigh->landed));
 
-        get_hitched(id);
-        --(num_reindeer_waiting);
+            /* all of the team has been hitched, christmas time! */
+            is_driver = (++(sleigh->num_hitched) == sleigh->team_size);
+            if(is_driver) {
+                sleigh->departed_ns = clock_ns();
+            }
+        });
 
-        /* all reindeer have been hitched, christmas time! */
-        if(0 == num_reindeer_waiting) {
-            fprintf(stdout, "Santa: Ho ho ho! Off to deliver presents! \n");
-            exit(EXIT_SUCCESS);
+        if(is_driver) {
+            deliver_presents(id, sleigh);
+        } else {
+            group_wait_generation(&(sleigh->landed), landed);
         }
-    });
+
+        CRITICAL(reindeer_counter_lock, {
+            reindeer_slots[id] = SLOT_HIRED;
+        });
+    }
 
     return NULL;
 }
 
 /**
  * ----------------------------------------------------------------------------
- * Set up and run the problem.
+ * Population-specific
  * ----------------------------------------------------------------------------
  */
 
 /**
- * Launch threads in sequence over some arrays of thread ids and arguments.
+ * Pin a newly started thread to a cpu according to the placement policy.
  */
-static void sequence_pthreads(int num_threads,
-                              pthread_t *thread_ids,
-                              void *(*func)(void *),
-                              int *args) {
-    int i;
-    for(i = 0; num_threads--; ++i) {
-        pthread_create(&(thread_ids[i]), NULL, func, (void *) &(args[i]));
+static void place_thread(pthread_t thread, const int is_santa) {
+    const int num_cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t cpus;
+    int cpu;
+
+    if(PLACEMENT_NONE == placement) {
+        return;
+    } else if(PLACEMENT_ISOLATE_SANTA == placement && 1 < num_cpus) {
+        cpu = is_santa
+            ? 0
+            : 1 + __sync_fetch_and_add(&next_cpu, 1) % (num_cpus - 1);
+    } else {
+        cpu = __sync_fetch_and_add(&next_cpu, 1) % num_cpus;
+    }
+
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if(0 != pthread_setaffinity_np(thread, sizeof cpus, &cpus)) {
+        perror("place_thread[pthread_setaffinity_np]");
+        exit(EXIT_FAILURE);
     }
 }
 
 /**
- * Free all resources. Note: performing a set_free as opposed to a
- * set_exit_free would result (usually) in an error calling free().
- *
- * So, why use an at-exit and signal handler? The motivation is so that while
- * testing and generally running this simulation, the person running can stop
- * it at any time they please using ctrl-C and still know that the semaphores
- * have been freed.
- *
- * Also, if any errors occur, e.g. in an assert, then exit is called then the
- * semaphores will STILL be freed. Thus, at-exit and as-sigterm is a sensible
- * way to meet the assignment requirement.
+ * Start a detached actor thread. Hired actors are never joined; they either
+ * retire on their own or the process exits.
  */
-static void free_resources(void) {
-    static int resources_freed = 0;
-    if(!resources_freed) {
-        resources_freed = 1;
-        fprintf(stdout,"\n... And that year was a Merry Christmas indeed!\n\n");
-        sem_empty_set(&sem_set);
-        sem_empty_set(&elf_line_set);
-        set_exit_free(elves_waiting);
+static void launch_actor(void *(*func)(void *), const int id) {
+    pthread_t thread_id;
+    actor_ids[id] = id;
+    trace_event(&elf == func ? TRACE_ELF : TRACE_REINDEER, id, TRACE_HIRED, 0);
+    if(0 != pthread_create(&thread_id, NULL, func, (void *) &(actor_ids[id]))) {
+        perror("launch_actor[pthread_create]");
+        exit(EXIT_FAILURE);
     }
+    place_thread(thread_id, 0);
+    pthread_detach(thread_id);
 }
 
 /**
- * Handle a SIGINT signal; make it call the at-exit handler.
+ * Hire a new elf into a free slot and start it working.
+ *
+ * Returns: the id of the new elf, or -1 if all MAX_ELVES slots are taken.
  */
-static void sigint_handler(int _) {
-    exit(EXIT_SUCCESS);
+static int hire_elf(void) {
+    int i;
+    int id = -1;
+
+    CRITICAL(population_lock, {
+        for(i = 0; i < MAX_ELVES; ++i) {
+            if(SLOT_FREE == elf_slots[i]) {
+                elf_slots[i] = SLOT_HIRED;
+                ++num_elves;
+                ++(regions[i % num_regions].num_elves);
+                id = i;
+                break;
+            }
+        }
+    });
+
+    if(0 <= id) {
+        launch_actor(&elf, id);
+    }
+
+    return id;
 }
 
 /**
- * Launch the threads.
+ * Retire an elf. The elf finishes whatever it's doing with santa before it
+ * actually leaves. A region's workforce never drops below one group,
+ * otherwise the elves left in its line could wait forever.
+ *
+ * Params: - Id of the elf to retire, or -1 for the highest-numbered hired elf
+ *           that its region can spare.
+ *
+ * Returns: the id of the retiring elf, or -1 if no elf could be retired.
  */
-static void launch_threads(void) {
+static int retire_elf(const int elf_id) {
+    int i;
+    int id = -1;
+
+    CRITICAL(population_lock, {
+        if(0 > elf_id) {
+            for(i = MAX_ELVES; i-- > 0; ) {
+                if(SLOT_HIRED == elf_slots[i]
+                && elves_per_group < regions[i % num_regions].num_elves) {
+                    break;
+                }
+            }
+        } else {
+            i = elf_id;
+        }
 
-    pthread_t thread_ids[1 + NUM_ELVES + NUM_REINDEER];
+        if(0 <= i && i < MAX_ELVES && SLOT_HIRED == elf_slots[i]
+        && elves_per_group < regions[i % num_regions].num_elves) {
+            elf_slots[i] = SLOT_RETIRING;
+            --num_elves;
+            --(regions[i % num_regions].num_elves);
+            id = i;
+        }
+    });
 
-    int ids[MAX(NUM_ELVES, NUM_REINDEER)];
-    int i; /* index into the ids */
+    return id;
+}
 
-    /* fill up the ids */
-    for(i = 0; i < MAX(NUM_ELVES, NUM_REINDEER); ++i) {
-        ids[i] = i;
-    }
+/**
+ * Hire a new reindeer and send it off on vacation. When teams are the whole
+ * herd this raises the "last one back" threshold of the team being formed.
+ *
+ * Returns: the id of the new reindeer, or -1 if it couldn't be hired.
+ */
+static int hire_reindeer(void) {
+    int i;
+    int id = -1;
 
-    /* start up santa, the elves, and the reindeer threads */
-    pthread_create(&(thread_ids[0]), NULL, &santa, NULL);
-    sequence_pthreads(NUM_ELVES, &(thread_ids[1]), &elf, &(ids[0]));
-    sequence_pthreads(NUM_REINDEER, thread_ids + 1 + NUM_ELVES, &reindeer, ids);
+    CRITICAL(reindeer_counter_lock, {
+        for(i = 0; i < MAX_REINDEER; ++i) {
+            if(SLOT_FREE == reindeer_slots[i]) {
+                reindeer_slots[i] = SLOT_HIRED;
+                ++num_reindeer;
+                id = i;
+                break;
+            }
+        }
+    });
 
-    /* necessary to wait instead of pthread_exit, otherwise stack, and so
-     * values pointed at by ids and thread_ids get corrupted. */
-    for(i = 0; i < (1 + NUM_ELVES + NUM_REINDEER); ++i) {
-        pthread_join(thread_ids[i], NULL);
+    if(0 <= id) {
+        launch_actor(&reindeer, id);
     }
+
+    return id;
 }
 
 /**
- * Simulate the Santa Claus Problem.
+ * Retire a reindeer that's still on vacation. The herd never gets smaller
+ * than one team. When teams are the whole herd, lowering the threshold might
+ * make the reindeer that are already back a full team, in which case santa
+ * is woken up in place of the retired reindeer.
+ *
+ * Params: - Id of the reindeer to retire, or -1 for any one on vacation.
+ *
+ * Returns: the id of the retiring reindeer, or -1 if none could be retired.
  */
-int main(void) {
-
-    sem_fill_set(&sem_set, 7);
-    sem_fill_set(&elf_line_set, NUM_ELVES);
+static int retire_reindeer(const int reindeer_id) {
+    int i;
+    int id = -1;
+    int is_last = 0;
 
-    elves_waiting = set_alloc(NUM_ELVES);
+    CRITICAL(reindeer_counter_lock, {
+        if(MAX(1, team_size) < num_reindeer) {
+            if(0 > reindeer_id) {
+                for(i = MAX_REINDEER; i-- > 0 && SLOT_HIRED != reindeer_slots[i];);
+            } else {
+                i = reindeer_id;
+            }
+
+            if(0 <= i && i < MAX_REINDEER && SLOT_HIRED == reindeer_slots[i]) {
+                reindeer_slots[i] = SLOT_RETIRING;
+                --num_reindeer;
+                id = i;
+                is_last = form_team();
+            }
+        }
+    });
+
+    if(is_last) {
+        LOG_INFO(("Control: the rest of the team is back; waking santa!\n"));
+        sem_signal(santa_sleep_mutex);
+    }
+
+    return id;
+}
+
+/**
+ * Read a single line from standard input. This deliberately avoids stdio so
+ * that the control thread never sits on the stdin lock, which would stall
+ * exit() while it flushes streams.
+ *
+ * Returns: 0 at the end of input, 1 otherwise.
+ */
+static int read_command(char *line, const int max_length) {
+    int i = 0;
+    char c;
+
+    while(i < (max_length - 1) && 1 == read(STDIN_FILENO, &c, 1)) {
+        line[i++] = c;
+        if('\n' == c) {
+            break;
+        }
+    }
+
+    line[i] = '\0';
+    return 0 < i;
+}
+
+/**
+ * Control thread. Reads commands from standard input, one per line:
+ *
+ *      hire elf | hire reindeer
+ *      retire elf [id] | retire reindeer [id]
+ *      status
+ *
+ * The simulation keeps running while the population changes. The thread exits
+ * quietly at the end of input.
+ */
+static void *control(void *_) {
+    char line[MAX_COMMAND_LENGTH];
+    char verb[MAX_COMMAND_LENGTH];
+    char noun[MAX_COMMAND_LENGTH];
+    int id;
+    int num_args;
+    int is_elf;
+
+    alloc_thread_phase(ALLOC_PHASE_CONTROL);
+
+    while(read_command(line, MAX_COMMAND_LENGTH)) {
+        id = -1;
+        num_args = sscanf(line, "%s %s %d", verb, noun, &id);
+        if(0 >= num_args) {
+            continue;
+        }
+
+        if(!strcmp(verb, "status")) {
+            LOG_INFO(("Control: %d elves, %d reindeer (%d back). \n",
+                num_elves, num_reindeer, num_reindeer_waiting
+            ));
+            continue;
+        }
+
+        is_elf = (2 <= num_args && !strcmp(noun, "elf"));
+        if(2 > num_args || !(is_elf || !strcmp(noun, "reindeer"))) {
+            LOG_WARN(("Control: unknown command: %s", line));
+
+        } else if(!strcmp(verb, "hire")) {
+            id = is_elf ? hire_elf() : hire_reindeer();
+            LOG_INFO(("Control: hired %s %d. \n", noun, id));
+
+        } else if(!strcmp(verb, "retire")) {
+            id = is_elf ? retire_elf(id) : retire_reindeer(id);
+            LOG_INFO(("Control: retired %s %d. \n", noun, id));
+
+        } else {
+            LOG_WARN(("Control: unknown command: %s", line));
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * ----------------------------------------------------------------------------
+ * Set up and run the problem.
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * Report how much work each region got done, what it cost the head santa to
+ * coordinate the regions before each sleigh left, and how quickly the sleighs
+ * delivered presents.
+ */
+static void print_report(FILE *out) {
+    unsigned long elapsed_ns = clock_ns() - start_ns;
+    unsigned long total = 0;
+    char name[32];
+    int i;
+
+    fprintf(out, "\nsetup took %.3fms since the %s\n",
+        (double) setup_ns / 1e6,
+        NULL == experiment_setup_ns ? "process started" : "fork"
+    );
+    fprintf(out, "%d region(s) over %.3fs:\n",
+        num_regions, (double) elapsed_ns / NS_PER_SEC
+    );
+    if(metrics & METRIC_THROUGHPUT) {
+        for(i = 0; i < num_regions; ++i) {
+            total += regions[i].num_groups_helped;
+            fprintf(out, "    region %d: %lu groups helped, %lu wakeups "
+                         "(%.2f per group)\n",
+                i, regions[i].num_groups_helped, regions[i].num_wakeups,
+                (double) regions[i].num_wakeups
+                    / (regions[i].num_groups_helped
+                       ? regions[i].num_groups_helped : 1)
+            );
+        }
+        fprintf(out, "    %.2f groups/s overall, %lu ns to quiesce regions\n",
+            (double) total * NS_PER_SEC / (double) (elapsed_ns ? elapsed_ns : 1),
+            quiesce_ns
+        );
+    }
+    if(metrics & METRIC_DELIVERIES) {
+        fprintf(out,
+            "%d reindeer in teams of %d, %d sleigh(s): %d deliveries, "
+            "%.1f deliveries/hour, %.3fs average flight\n"
+            "    %d sleighs prepared in %lu wakeups\n",
+            num_reindeer, team_threshold(), num_sleighs, num_deliveries,
+            3600.0 * num_deliveries * NS_PER_SEC
+                / (double) (elapsed_ns ? elapsed_ns : 1),
+            num_deliveries ? (double) flight_ns / num_deliveries / NS_PER_SEC
+                           : 0.0,
+            group_generation(&teams_prepared), num_santa_wakeups
+        );
+    }
+    if(metrics & METRIC_LATENCY) {
+        fprintf(out, "latencies with preemption %s:\n",
+            preemption ? "on" : "off"
+        );
+        hist_report(&elf_latency, out);
+        hist_report(&departure_latency, out);
+        hist_report(&wakeup_latency, out);
+        hist_report(&sem_wait_latency, out);
+        hist_report(&set_hold_latency, out);
+        fprintf(out, "    ");
+        clock_describe(out);
+    }
+    if(metrics & METRIC_STATES) {
+        fprintf(out, "time spent in each state (times entered):\n");
+        state_report(&santa_state, "santa", out);
+        for(i = 0; i < num_regions; ++i) {
+            sprintf(name, "santa %d", i);
+            state_report(&(regions[i].state), name, out);
+        }
+    }
+}
+
+/**
+ * Write out a latency histogram in its serialized form, after its name.
+ */
+static void write_histogram(hist_recorder_t *recorder, FILE *out) {
+    static hist_t snapshot;
+    hist_snapshot(recorder, &snapshot);
+    if(recorder->in_ticks) {
+        fprintf(out, "# %s, in ticks of %.6f ns: ",
+            recorder->name, clock_ns_per_tick()
+        );
+    } else {
+        fprintf(out, "# %s, in ns: ", recorder->name);
+    }
+    hist_write(&snapshot, out);
+}
+
+/**
+ * Write out one setting to the results, unless the backend doesn't support
+ * it, in which case it would only be misleading.
+ */
+static void write_setting(FILE *out,
+                          const int setting,
+                          const char *format,
+                          ...) {
+    va_list args;
+
+    if(unsupported_settings[backend] & setting) {
+        return;
+    }
+
+    va_start(args, format);
+    vfprintf(out, format, args);
+    va_end(args);
+}
+
+/**
+ * Write out everything that the experiment was run with, in the same format
+ * as a scenario file, followed by the report if there is one.
+ */
+static void write_results(const int with_report) {
+    FILE *out;
+
+    if(NULL == results_path) {
+        return;
+    }
+
+    out = fopen(results_path, "w");
+    if(NULL == out) {
+        perror("write_results[fopen]");
+        return;
+    }
+
+    fprintf(out, "# santaclaus results\n");
+    scenario_describe(&scenario, out);
+    fprintf(out,
+        "build.group_wake = %d\n"
+        "build.observable_delays = %d\n"
+        "\n"
+        "backend = %s\n"
+        "executors = %d\n"
+        "elves = %d\n"
+        "reindeer = %d\n"
+        "group_size = %d\n",
+        GROUP_WAKE, OBSERVABLE_DELAYS,
+        backend_names[backend], num_executors,
+        num_initial_elves, num_initial_reindeer, elves_per_group
+    );
+
+    write_setting(out, SETTING_ADMISSION,
+        "admission = %s\n", admission_names[admission]
+    );
+    write_setting(out, SETTING_DRAIN, "drain = %d\n", drain);
+    write_setting(out, SETTING_REGIONS, "regions = %d\n", num_regions);
+    write_setting(out, SETTING_TEAM_SIZE, "team_size = %d\n", team_size);
+    write_setting(out, SETTING_SLEIGHS, "sleighs = %d\n", num_sleighs);
+    write_setting(out, SETTING_DELIVERIES,
+        "deliveries = %d\n", max_deliveries
+    );
+    write_setting(out, SETTING_MAX_WAIT, "max_wait = %d\n", max_wait_time);
+    write_setting(out, SETTING_MAX_HELP, "max_help = %d\n", max_help_time);
+    write_setting(out, SETTING_WAIT_DELAY,
+        "wait_delay = %s\n", delay_names[wait_delay]
+    );
+    write_setting(out, SETTING_HELP_DELAY,
+        "help_delay = %s\n", delay_names[help_delay]
+    );
+    write_setting(out, SETTING_DURATION, "duration = %d\n", duration);
+    write_setting(out, SETTING_WORKLOAD, "workload = %s\n", workload_name);
+    write_setting(out, SETTING_PLACEMENT,
+        "placement = %s\n", placement_names[placement]
+    );
+    write_setting(out, SETTING_PREEMPTION,
+        "preemption = %d\n", preemption
+    );
+
+    fprintf(out,
+        "log_level = %s\n"
+        "quiet = %d\n",
+        log_level_names[log_level], quiet
+    );
+
+    write_setting(out, SETTING_WATCHDOG,
+        "watchdog = %d\n", watchdog_stall_ms
+    );
+    write_setting(out, SETTING_SAMPLE_FILE,
+        "sample_file = %s\n"
+        "sample_period_us = %d\n",
+        NULL == sample_path ? "" : sample_path, sample_period_us
+    );
+    write_setting(out, SETTING_PROFILE_FILE,
+        "profile_file = %s\n"
+        "profile_period_us = %d\n"
+        "profile_depth = %d\n",
+        NULL == profile_path ? "" : profile_path, profile_period_us,
+        profile_depth
+    );
+
+    fprintf(out,
+        "seed = %u\n"
+        "metrics =%s%s%s%s\n",
+        seed,
+        (metrics & METRIC_THROUGHPUT) ? " throughput" : "",
+        (metrics & METRIC_DELIVERIES) ? " deliveries" : "",
+        (metrics & METRIC_LATENCY) ? " latency" : "",
+        (metrics & METRIC_STATES) ? " states" : ""
+    );
+
+    if(with_report) {
+        fprintf(out, "\n# report\n");
+        print_report(out);
+    }
+
+    if(with_report && (metrics & METRIC_LATENCY)) {
+        fprintf(out, "\n# histograms, as count sum min max bucket:counts\n");
+        write_histogram(&elf_latency, out);
+        write_histogram(&departure_latency, out);
+        write_histogram(&wakeup_latency, out);
+        write_histogram(&sem_wait_latency, out);
+        write_histogram(&set_hold_latency, out);
+    }
+
+    fclose(out);
+}
+
+/**
+ * Read in a scenario file. Anything that the scenario doesn't mention keeps
+ * its current value, so options given before -s are overridden by the
+ * scenario and options given after it override the scenario.
+ */
+static void load_scenario(const char *path) {
+    scenario_load(&scenario, path);
+
+    backend = (backend_t) scenario_choice(
+        &scenario, "backend", backend_names, backend
+    );
+    num_executors = scenario_int(&scenario, "executors", num_executors);
+    num_initial_elves = scenario_int(&scenario, "elves", num_initial_elves);
+    num_initial_reindeer = scenario_int(
+        &scenario, "reindeer", num_initial_reindeer
+    );
+    elves_per_group = scenario_int(&scenario, "group_size", elves_per_group);
+    admission = (admission_t) scenario_choice(
+        &scenario, "admission", admission_names, admission
+    );
+    drain = scenario_int(&scenario, "drain", drain);
+    num_regions = scenario_int(&scenario, "regions", num_regions);
+    team_size = scenario_int(&scenario, "team_size", team_size);
+    num_sleighs = scenario_int(&scenario, "sleighs", num_sleighs);
+    max_deliveries = scenario_int(&scenario, "deliveries", max_deliveries);
+    max_wait_time = scenario_int(&scenario, "max_wait", max_wait_time);
+    max_help_time = scenario_int(&scenario, "max_help", max_help_time);
+    wait_delay = (delay_t) scenario_choice(
+        &scenario, "wait_delay", delay_names, wait_delay
+    );
+    help_delay = (delay_t) scenario_choice(
+        &scenario, "help_delay", delay_names, help_delay
+    );
+    workload_name = scenario_string(&scenario, "workload", workload_name);
+    placement = (placement_t) scenario_choice(
+        &scenario, "placement", placement_names, placement
+    );
+    preemption = scenario_int(&scenario, "preemption", preemption);
+    log_level = scenario_choice(
+        &scenario, "log_level", log_level_names, log_level
+    );
+    quiet = scenario_int(&scenario, "quiet", quiet);
+    watchdog_stall_ms = scenario_int(&scenario, "watchdog", watchdog_stall_ms);
+    sample_path = scenario_string(&scenario, "sample_file", sample_path);
+    sample_period_us = scenario_int(
+        &scenario, "sample_period_us", sample_period_us
+    );
+    profile_path = scenario_string(&scenario, "profile_file", profile_path);
+    profile_period_us = scenario_int(
+        &scenario, "profile_period_us", profile_period_us
+    );
+    profile_depth = scenario_int(&scenario, "profile_depth", profile_depth);
+    duration = scenario_int(&scenario, "duration", duration);
+    seed = (unsigned int) scenario_int(&scenario, "seed", (int) seed);
+    metrics = scenario_flags(&scenario, "metrics", metric_names, metrics);
+    results_path = scenario_string(&scenario, "results", results_path);
+
+    scenario_check(&scenario);
+}
+
+/**
+ * Free all resources. Note: performing a set_free as opposed to a
+ * set_exit_free would result (usually) in an error calling free().
+ *
+ * So, why use an at-exit and signal handler? The motivation is so that while
+ * testing and generally running this simulation, the person running can stop
+ * it at any time they please using ctrl-C and still know that the semaphores
+ * have been freed.
+ *
+ * Also, if any errors occur, e.g. in an assert, then exit is called then the
+ * semaphores will STILL be freed. Thus, at-exit and as-sigterm is a sensible
+ * way to meet the assignment requirement.
+ */
+static void free_resources(void) {
+    static int resources_freed = 0;
+    unsigned long num_steady_allocs;
+    int i;
+    if(!resources_freed) {
+        resources_freed = 1;
+        alloc_phase(ALLOC_PHASE_TEARDOWN);
+        alloc_thread_phase(ALLOC_PHASE_TEARDOWN);
+        log_close();
+        sampler_stop();
+        prof_stop();
+        print_report(stdout);
+        log_report(stdout);
+        sampler_report(stdout);
+        prof_report(stdout);
+        num_steady_allocs = alloc_report(stdout);
+        write_results(1);
+        fprintf(stdout,"\n... And that year was a Merry Christmas indeed!\n\n");
+        sem_empty_set(&sem_set);
+        sem_empty_set(&elf_line_set);
+        sem_empty_set(&sleigh_set);
+        for(i = 0; i < num_regions; ++i) {
+            sem_empty_set(&(regions[i].sem_set));
+            set_exit_free(regions[i].elves_waiting);
+            pset_exit_free(regions[i].elves_by_age);
+        }
+
+        /* allocating once the simulation is running fails the run; this is
+         * an at-exit handler, so exit can't be called again. */
+        if(num_steady_allocs) {
+            fflush(stdout);
+            _exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Handle a SIGINT signal, or the end of the scenario's duration; make it call
+ * the at-exit handler.
+ */
+static void sigint_handler(int _) {
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * Print out the values of the semaphores in a set.
+ */
+static void dump_semaphores(FILE *out,
+                            const char *name,
+                            sem_set_t *set,
+                            const int num_semaphores) {
+    unsigned short values[MAX(MAX_ELVES, MAX_SLEIGHS)];
+    int i;
+
+    fprintf(out, "    %s:", name);
+    if(-1 == sem_get_all(set, &(values[0]))) {
+        fprintf(out, " (unavailable)\n");
+        return;
+    }
+    for(i = 0; i < num_semaphores; ++i) {
+        fprintf(out, " %u", values[i]);
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * Print out the state of every actor that has done anything, and for how
+ * long it's been in that state.
+ */
+static void dump_actors(FILE *out,
+                        const trace_actor_t actor,
+                        const int first_id,
+                        const int num_ids) {
+    unsigned long num_beats;
+    unsigned long idle_ns;
+    int state;
+    int id;
+
+    for(id = first_id; id < num_ids; ++id) {
+        state = watchdog_state(heartbeat_slot(actor, id), &num_beats, &idle_ns);
+        if(0 > state) {
+            continue;
+        }
+        fprintf(out, "    %s %d: %s for %.3fs (%lu events)\n",
+            trace_actor_name(actor), id, trace_event_name(state),
+            (double) idle_ns / NS_PER_SEC, num_beats
+        );
+    }
+}
+
+/**
+ * Dump the semaphore values, the elves waiting in each region, and every
+ * actor's state when the watchdog notices that progress has stopped. None of
+ * this takes any locks, as whoever is stuck may be holding them.
+ */
+static void dump_stall(FILE *out, const unsigned long stalled_ns) {
+    char name[64];
+    int word;
+    int i;
+
+    fprintf(out, "semaphores:\n");
+    dump_semaphores(out,
+        "reindeer_counter_lock santa_sleep_mutex population_lock", &sem_set, 3
+    );
+    dump_semaphores(out, "sleighs", &sleigh_set, num_sleighs);
+    dump_semaphores(out, "elf line", &elf_line_set, MAX_ELVES);
+    for(i = 0; i < num_regions; ++i) {
+        sprintf(name, "region %d sleep count elf", i);
+        dump_semaphores(out, name, &(regions[i].sem_set), 3);
+    }
+
+    fprintf(out, "queues:\n");
+    for(i = 0; i < num_regions; ++i) {
+        fprintf(out, "    region %d elves waiting: ", i);
+        if(ADMISSION_OLDEST == admission) {
+            pset_print(regions[i].elves_by_age, out);
+        } else {
+            set_print(regions[i].elves_waiting, out);
+        }
+        word = state_load(&(regions[i].state));
+        fprintf(out, ", santa %s %d, %d left in group\n",
+            state_names[STATE_OF(word)], STATE_COUNT(word),
+            regions[i].num_elves_left_in_group
+        );
+    }
+    fprintf(out, "    %d of %d reindeer back, %d teams formed, %d prepared, "
+                 "%d deliveries\n",
+        num_reindeer_waiting, num_reindeer, num_teams_formed,
+        group_generation(&teams_prepared), num_deliveries
+    );
+
+    fprintf(out, "actors:\n");
+    dump_actors(out, TRACE_SANTA, -1, num_regions);
+    dump_actors(out, TRACE_ELF, 0, MAX_ELVES);
+    dump_actors(out, TRACE_REINDEER, 0, MAX_REINDEER);
+}
+
+/**
+ * Have the sampler watch every semaphore and group that the actors wait on.
+ */
+static void watch_semaphores(void) {
+    static const char *region_sem_names[] = {
+        "sleep_mutex", "elf_counting_sem", "elf_mutex"
+    };
+    char name[SAMPLER_MAX_NAME_LENGTH];
+    sem_t sem;
+    int i;
+    int j;
+
+    sampler_watch(reindeer_counter_lock, "reindeer_counter_lock");
+    sampler_watch(santa_sleep_mutex, "santa_sleep_mutex");
+    sampler_watch(population_lock, "population_lock");
+    sampler_watch_count(&(teams_prepared.num_waiters), "teams_prepared");
+    sampler_watch_count(&(santa_state.num_waiters), "santa_state");
+
+    for(i = 0; i < num_regions; ++i) {
+        for(j = 0; j < 3; ++j) {
+            sem.set = &(regions[i].sem_set);
+            sem.num = j;
+            sprintf(name, "%d:%s", i, region_sem_names[j]);
+            sampler_watch(sem, name);
+        }
+        sprintf(name, "%d:elf_group", i);
+        sampler_watch_count(&(regions[i].elf_group.num_waiters), name);
+
+        /* what the region's busy mutex used to be; see state.c. */
+        sprintf(name, "%d:state", i);
+        sampler_watch_count(&(regions[i].state.num_waiters), name);
+    }
+
+    for(i = 0; i < num_sleighs; ++i) {
+        sem.set = &sleigh_set;
+        sem.num = i;
+        sprintf(name, "sleigh_%d", i);
+        sampler_watch(sem, name);
+        sprintf(name, "sleigh_%d_landed", i);
+        sampler_watch_count(&(sleighs[i].landed.num_waiters), name);
+    }
+
+    for(i = 0; i < MAX_ELVES; ++i) {
+        sem.set = &elf_line_set;
+        sem.num = i;
+        sprintf(name, "elf_line_%d", i);
+        sampler_watch(sem, name);
+    }
+}
+
+/**
+ * Print out aggregate counters every QUIET_INTERVAL_NS. The counters are read
+ * without any locking, so they can be slightly out of date.
+ */
+static void *quiet_reporter(void *_) {
+    struct timespec interval;
+    unsigned long num_groups;
+    unsigned long last_num_groups = 0;
+    unsigned long now_ns;
+    unsigned long last_ns = start_ns;
+    unsigned long oldest_ns;
+    unsigned long age_ns;
+    char oldest[64];
+    int i;
+
+    interval.tv_sec = (time_t) (QUIET_INTERVAL_NS / NS_PER_SEC);
+    interval.tv_nsec = (long) (QUIET_INTERVAL_NS % NS_PER_SEC);
+
+    while(1) {
+        nanosleep(&interval, NULL);
+
+        num_groups = 0;
+        oldest_ns = 0;
+        for(i = 0; i < num_regions; ++i) {
+            num_groups += regions[i].num_groups_helped;
+            if(ADMISSION_OLDEST == admission) {
+                age_ns = pset_oldest_age(regions[i].elves_by_age);
+                oldest_ns = MAX(oldest_ns, age_ns);
+            }
+        }
+        now_ns = clock_ns();
+
+        /* how long the elf at the front of the longest line has waited. */
+        oldest[0] = '\0';
+        if(ADMISSION_OLDEST == admission) {
+            sprintf(oldest, ", oldest elf in line for %.3fms",
+                (double) oldest_ns / 1000000.0
+            );
+        }
+
+        log_printf("[%8.3fs] %lu groups helped (%.1f/s), %lu elves helped, "
+                   "%d teams formed, %d deliveries%s\n",
+            (double) (now_ns - start_ns) / NS_PER_SEC,
+            num_groups,
+            (double) (num_groups - last_num_groups) * NS_PER_SEC
+                / (double) (now_ns - last_ns),
+            hist_count(&elf_latency), num_teams_formed, num_deliveries,
+            oldest
+        );
+
+        last_num_groups = num_groups;
+        last_ns = now_ns;
+    }
+
+    return NULL;
+}
+
+/**
+ * Launch the threads. The head santa is the only thread that is joined;
+ * elves and reindeer come and go, and the others never finish.
+ */
+static void launch_threads(void) {
+
+    pthread_t santa_id;
+    pthread_t thread_id;
+    int i;
+
+    /* everything that runs from here on is in the steady state, except for
+     * this thread while it starts everyone up. */
+    alloc_thread_phase(ALLOC_PHASE_SETUP);
+    alloc_phase(ALLOC_PHASE_STEADY);
+
+    /* hire the whole starting population before anyone starts so that an
+     * early reindeer doesn't see a partial herd. */
+    for(i = 0; i < num_initial_elves; ++i) {
+        elf_slots[i] = SLOT_HIRED;
+    }
+    for(i = 0; i < num_initial_reindeer; ++i) {
+        reindeer_slots[i] = SLOT_HIRED;
+    }
+    for(i = 0; i < num_initial_elves; ++i) {
+        ++(regions[i % num_regions].num_elves);
+    }
+    num_elves = num_initial_elves;
+    num_reindeer = num_initial_reindeer;
+    start_ns = clock_ns();
+
+    /* start up the santas, the elves, and the reindeer threads */
+    pthread_create(&santa_id, NULL, &santa, NULL);
+    place_thread(santa_id, 1);
+    for(i = 0; i < num_regions; ++i) {
+        pthread_create(&thread_id, NULL, &regional_santa, &(regions[i]));
+        place_thread(thread_id, 1);
+        pthread_detach(thread_id);
+    }
+    for(i = 0; i < num_initial_elves; ++i) {
+        launch_actor(&elf, i);
+    }
+    for(i = 0; i < num_initial_reindeer; ++i) {
+        launch_actor(&reindeer, i);
+    }
+
+    pthread_create(&thread_id, NULL, &control, NULL);
+    pthread_detach(thread_id);
+
+    setup_ns = clock_ns() - launch_ns;
+    if(NULL != experiment_setup_ns) {
+        *experiment_setup_ns = setup_ns;
+    }
+
+    if(quiet) {
+        pthread_create(&thread_id, NULL, &quiet_reporter, NULL);
+        pthread_detach(thread_id);
+    }
+
+    if(NULL != sample_path) {
+        watch_semaphores();
+        sampler_start(sample_path, (unsigned long) sample_period_us * 1000UL);
+    }
+
+    if(NULL != profile_path) {
+        prof_start(profile_path,
+            (unsigned long) profile_period_us, profile_depth
+        );
+    }
+
+    if(0 < watchdog_stall_ms) {
+        watchdog_start(NUM_HEARTBEAT_SLOTS,
+            (unsigned long) watchdog_stall_ms * (NS_PER_SEC / 1000),
+            &dump_stall
+        );
+    }
+
+    alloc_thread_phase(ALLOC_PHASE_STEADY);
+    pthread_join(santa_id, NULL);
+}
+
+/**
+ * Create and initialize a region's semaphores and waiting line.
+ */
+static void init_region(region_t *region, const int id) {
+    region->id = id;
+    region->num_elves_left_in_group = 0;
+    region->is_interrupted = 0;
+    region->next_ticket = 0;
+    region->next_ticket_served = 0;
+    region->num_elves = 0;
+    region->num_groups_helped = 0;
+    region->num_wakeups = 0;
+    region->woken_ns = 0;
+
+    state_init(&(region->state), STATE_WORD(STATE_SLEEPING, 0));
+
+    sem_fill_set(&(region->sem_set), 3);
+    sem_unpack_set(&(region->sem_set),
+        &(region->sleep_mutex),
+        &(region->elf_counting_sem),
+        &(region->elf_mutex)
+    );
+
+    sem_init(region->sleep_mutex, 0); /* starts as locked! */
+    sem_init(region->elf_counting_sem, elves_per_group);
+    sem_init(region->elf_mutex, 1);
+
+    region->elves_waiting = set_alloc(MAX_ELVES);
+    if(NULL == region->elves_waiting) {
+        perror("init_region[set_alloc]");
+        exit(EXIT_FAILURE);
+    }
+
+    region->elves_by_age = pset_alloc(MAX_ELVES);
+    if(NULL == region->elves_by_age) {
+        perror("init_region[pset_alloc]");
+        exit(EXIT_FAILURE);
+    }
+
+    group_init(&(region->elf_group));
+}
+
+/**
+ * Print out how to run the simulation.
+ */
+static int usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s [-s scenario] [-o results] [-t trace_file]\n"
+        "          [-r num_regions] [-T team_size]\n"
+        "          [-S num_sleighs] [-D num_deliveries] [-w workload]\n"
+        "          [-L log_level] [-q] [-W stall_ms] [-Q sample_file] [-P]\n"
+        "          [-A set|tickets|oldest] [-d] [-p profile_file]\n",
+        program
+    );
+    fprintf(stderr,
+        "       %s [-t trace_file] -c [num_elves [num_reindeer [executors]]]\n"
+        "       %s [-w workload] -E [num_elves [num_reindeer [partitions]]]\n"
+        "       %s [options] -C [num_elves [num_reindeer [cores]]]\n"
+        "       %s [options] -F scenario [scenario ...]\n",
+        program, program, program, program
+    );
+    fprintf(stderr, "Built-in workloads: ");
+    workload_list(stderr);
+    fprintf(stderr, "\n");
+    return EXIT_FAILURE;
+}
+
+/**
+ * Do the setup that doesn't depend on anything but the workload's name, and
+ * that a forked experiment can share with its fork server.
+ *
+ * Returns: 1 on success, 0 if the workload couldn't be loaded.
+ */
+static int load_shared(void) {
+    if(NULL == loaded_workload_name || strcmp(loaded_workload_name, workload_name)) {
+        workload = workload_find(workload_name);
+        if(NULL == workload) {
+            return 0;
+        }
+        loaded_workload_name = workload_name;
+    }
+
+    if(NULL == elf_latency.name) {
+        clock_calibrate();
+        hist_recorder_init(&elf_latency, "elf help", 0);
+        hist_recorder_init(&departure_latency, "sleigh departure", 0);
+        hist_recorder_init(&wakeup_latency, "santa wake-up", 0);
+        hist_recorder_init(&sem_wait_latency, "semaphore wait", 1);
+        hist_recorder_init(&set_hold_latency, "set lock hold", 1);
+    }
+
+    return 1;
+}
+
+/**
+ * Make sure that none of the settings that the backend doesn't support have
+ * been changed from their defaults, as they would be silently ignored.
+ *
+ * Returns: 1 if the backend supports everything it was given, 0 otherwise.
+ */
+static int check_settings(void) {
+    int changed = 0;
+    int i;
+
+    changed |= strcmp(WORKLOAD, workload_name) ? SETTING_WORKLOAD : 0;
+    changed |= NUM_REGIONS != num_regions ? SETTING_REGIONS : 0;
+    changed |= ADMISSION != admission ? SETTING_ADMISSION : 0;
+    changed |= DRAIN != drain ? SETTING_DRAIN : 0;
+    changed |= PREEMPTION != preemption ? SETTING_PREEMPTION : 0;
+    changed |= TEAM_SIZE != team_size ? SETTING_TEAM_SIZE : 0;
+    changed |= NUM_SLEIGHS != num_sleighs ? SETTING_SLEIGHS : 0;
+    changed |= NUM_DELIVERIES != max_deliveries ? SETTING_DELIVERIES : 0;
+    changed |= MAX_WAIT_TIME != max_wait_time ? SETTING_MAX_WAIT : 0;
+    changed |= MAX_HELP_TIME != max_help_time ? SETTING_MAX_HELP : 0;
+    changed |= WAIT_DELAY != wait_delay ? SETTING_WAIT_DELAY : 0;
+    changed |= HELP_DELAY != help_delay ? SETTING_HELP_DELAY : 0;
+    changed |= DURATION != duration ? SETTING_DURATION : 0;
+    changed |= PLACEMENT != placement ? SETTING_PLACEMENT : 0;
+    changed |= WATCHDOG_STALL_MS != watchdog_stall_ms ? SETTING_WATCHDOG : 0;
+    changed |= NULL != sample_path ? SETTING_SAMPLE_FILE : 0;
+    changed |= NULL != profile_path ? SETTING_PROFILE_FILE : 0;
+
+    changed &= unsupported_settings[backend];
+    if(!changed) {
+        return 1;
+    }
+
+    fprintf(stderr, "The %s backend doesn't support:", backend_names[backend]);
+    for(i = 0; NULL != setting_names[i]; ++i) {
+        if(changed & (1 << i)) {
+            fprintf(stderr, " %s", setting_names[i]);
+        }
+    }
+    fprintf(stderr, ".\n");
+    return 0;
+}
+
+/**
+ * Run the elves and reindeer as coroutines on a pool of executor threads, by
+ * default one per online processor, until the first sleigh leaves.
+ *
+ * Returns: the process exit status.
+ */
+static int simulate_coroutines(void) {
+    if(0 >= num_executors) {
+        num_executors = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    if(0 >= elves_per_group || CORO_MAX_GROUP_SIZE < elves_per_group
+    || num_initial_elves < elves_per_group || 0 >= num_initial_reindeer) {
+        fprintf(stderr, "Groups of 1 to %d elves, at least one group of "
+                        "elves, and at least one reindeer are supported.\n",
+            CORO_MAX_GROUP_SIZE
+        );
+        return EXIT_FAILURE;
+    }
+
+    write_results(0);
+    return santa_coro_simulate(
+        num_initial_elves, num_initial_reindeer, elves_per_group, seed,
+        num_executors
+    );
+}
+
+/**
+ * Run the discrete-event simulation, with one partition per executor, or the
+ * sequential engine if there are no executors.
+ *
+ * Returns: the process exit status.
+ */
+static int simulate_events(void) {
+    des_config_t config;
+
+    if(!load_shared()) {
+        return usage(program_name);
+    }
+
+    des_config_init(&config);
+    config.num_elves = num_initial_elves;
+    config.num_reindeer = num_initial_reindeer;
+    config.group_size = elves_per_group;
+    config.num_partitions = num_executors;
+    config.seed = (unsigned long) seed;
+    config.workload = workload;
+
+    write_results(0);
+    return des_simulate(&config);
+}
+
+/**
+ * Run the elves and reindeer on a thread per core with nothing shared between
+ * the cores, by default on every online processor but the one santa gets.
+ *
+ * Returns: the process exit status.
+ */
+static int simulate_cores(void) {
+    cores_config_t config;
+
+    if(!load_shared()) {
+        return usage(program_name);
+    }
+
+    if(0 >= num_executors) {
+        num_executors = MAX(1, (int) sysconf(_SC_NPROCESSORS_ONLN) - 1);
+    }
+
+    /* cores_simulate checks the rest. */
+    if(0 > duration) {
+        fprintf(stderr, "A duration of 0 or more seconds is supported.\n");
+        return EXIT_FAILURE;
+    }
+
+    cores_config_init(&config);
+    config.num_elves = num_initial_elves;
+    config.num_reindeer = num_initial_reindeer;
+    config.group_size = elves_per_group;
+    config.num_cores = num_executors;
+    config.max_wait_time = max_wait_time;
+    config.max_help_time = max_help_time;
+    config.duration_ns = (unsigned long) duration * NS_PER_SEC;
+    config.max_deliveries = max_deliveries;
+    config.seed = (unsigned long) seed;
+    config.workload = workload;
+
+    write_results(0);
+    return cores_simulate(&config);
+}
+
+/**
+ * Run one experiment with the current settings.
+ *
+ * Returns: the process exit status.
+ */
+static int run_experiment(void) {
+    int i;
+
+    if(0 == seed) {
+        seed = (unsigned int) time(NULL);
+    }
+
+    if(quiet) {
+        log_level = LOG_LEVEL_NONE;
+    }
+
+    if(!check_settings()) {
+        return EXIT_FAILURE;
+    }
+
+    if(BACKEND_COROUTINES == backend) {
+        return simulate_coroutines();
+    }
+
+    if(BACKEND_DES == backend) {
+        return simulate_events();
+    }
+
+    if(BACKEND_CORES == backend) {
+        return simulate_cores();
+    }
+
+    if(0 >= elves_per_group || MAX_ELVES_PER_GROUP < elves_per_group
+    || 0 >= num_initial_elves || MAX_ELVES < num_initial_elves
+    || 0 >= num_initial_reindeer || MAX_REINDEER < num_initial_reindeer
+    || 0 >= max_wait_time || 0 >= max_help_time || 0 >= sample_period_us) {
+        fprintf(stderr, "Groups of 1 to %d elves, 1 to %d elves, 1 to %d "
+                        "reindeer, and positive wait times are supported.\n",
+            MAX_ELVES_PER_GROUP, MAX_ELVES, MAX_REINDEER
+        );
+        return EXIT_FAILURE;
+    }
+
+    if(0 >= profile_period_us
+    || 0 > profile_depth || PROF_MAX_DEPTH < profile_depth) {
+        fprintf(stderr, "Positive profile periods and profiles of 0 to %d "
+                        "stack frames are supported.\n",
+            PROF_MAX_DEPTH
+        );
+        return EXIT_FAILURE;
+    }
+
+    /* every region needs at least one group's worth of elves. */
+    if(0 >= num_regions
+    || MAX_REGIONS < num_regions
+    || num_initial_elves < num_regions * elves_per_group) {
+        fprintf(stderr, "Between 1 and %d regions are supported.\n",
+            MAX(1, num_initial_elves / elves_per_group)
+        );
+        return EXIT_FAILURE;
+    }
+
+    if(0 > team_size || num_initial_reindeer < team_size
+    || 0 >= num_sleighs || MAX_SLEIGHS < num_sleighs
+    || 0 >= max_deliveries) {
+        fprintf(stderr, "Teams of 0 to %d reindeer, 1 to %d sleighs, and at "
+                        "least one delivery are supported.\n",
+            num_initial_reindeer, MAX_SLEIGHS
+        );
+        return EXIT_FAILURE;
+    }
+
+    if(!load_shared()) {
+        return usage(program_name);
+    }
+
+    sem_fill_set(&sem_set, 3);
+    sem_fill_set(&elf_line_set, MAX_ELVES);
+    sem_fill_set(&sleigh_set, num_sleighs);
+
+    for(i = 0; i < num_regions; ++i) {
+        init_region(&(regions[i]), i);
+    }
 
     if(!atexit(&free_resources)) {
         signal(SIGINT, &sigint_handler);
@@ -430,27 +2525,41 @@ int main(void) {
 
         sem_unpack_set(&sem_set,
             &reindeer_counter_lock,
-            &elf_counter_lock,
-            &santa_busy_mutex,
             &santa_sleep_mutex,
-            &reindeer_counting_sem,
-            &elf_counting_sem,
-            &elf_mutex
+            &population_lock
         );
 
-        sem_init(elf_mutex, 1);
+        sem_init(population_lock, 1);
         sem_init(reindeer_counter_lock, 1);
-        sem_init(elf_counter_lock, 1);
-        sem_init(santa_busy_mutex, 1);
         sem_init(santa_sleep_mutex, 0); /* starts as locked! */
-        sem_init(reindeer_counting_sem, 0);
-        sem_init(elf_counting_sem, NUM_ELVES_PER_GROUP);
 
         /* initialize all elf semaphores as mutexes that start off *locked* */
         sem_init_all(&elf_line_set, 0);
 
+        /* every sleigh starts off in the stable. */
+        sem_init_all(&sleigh_set, 1);
+        group_init(&teams_prepared);
+        state_init(&santa_state, STATE_WORD(STATE_SLEEPING, 0));
+        for(i = 0; i < num_sleighs; ++i) {
+            group_init(&(sleighs[i].landed));
+        }
+
         /* pseudo-random numbers are used for making random-length busy waits.*/
-        srand((unsigned int) time(NULL));
+        srand(seed);
+
+        if(ASYNC_LOG) {
+            log_open(STDOUT_FILENO);
+        }
+
+        if(0 < duration) {
+            signal(SIGALRM, &sigint_handler);
+            alarm((unsigned int) duration);
+        }
+
+        if(metrics & METRIC_LATENCY) {
+            sem_record_waits(&sem_wait_latency);
+            set_record_holds(&set_hold_latency);
+        }
 
         launch_threads();
 
@@ -459,8 +2568,250 @@ int main(void) {
         free_resources();
     }
 
-    set_free(elves_waiting);
+    for(i = 0; i < num_regions; ++i) {
+        set_free(regions[i].elves_waiting);
+        pset_free(regions[i].elves_by_age);
+    }
 
     return 0;
 }
 
+/**
+ * Run one experiment per scenario file, each in a freshly forked child. The
+ * parent does the setup that is safe to share once, i.e. loading the workload
+ * and allocating the latency histograms, so that each child only creates its
+ * own semaphores, sets, and threads. A scenario path of "-" runs an experiment
+ * with the settings given before -F.
+ *
+ * Returns: the process exit status; failure if any experiment failed.
+ */
+static int fork_server(char **paths, const int num_experiments) {
+    unsigned long *setup_times;
+    unsigned long shared_ns;
+    unsigned long total_ns = 0;
+    int num_failed = 0;
+    int status;
+    pid_t pid;
+    int i;
+
+    if(0 >= num_experiments || MAX_EXPERIMENTS < num_experiments
+    || !load_shared()) {
+        return usage(program_name);
+    }
+
+    /* the children write their setup times straight into shared memory. */
+    setup_times = (unsigned long *) mmap(NULL,
+        sizeof(unsigned long) * num_experiments, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0
+    );
+    if(MAP_FAILED == (void *) setup_times) {
+        perror("fork_server[mmap]");
+        return EXIT_FAILURE;
+    }
+
+    shared_ns = clock_ns() - launch_ns;
+
+    for(i = 0; i < num_experiments; ++i) {
+        fflush(stdout);
+        fflush(stderr);
+        setup_times[i] = 0;
+        launch_ns = clock_ns();
+
+        pid = fork();
+        if(-1 == pid) {
+            perror("fork_server[fork]");
+            return EXIT_FAILURE;
+
+        } else if(0 == pid) {
+            experiment_setup_ns = &(setup_times[i]);
+            if(strcmp(paths[i], "-")) {
+                load_scenario(paths[i]);
+            }
+            exit(run_experiment());
+        }
+
+        if(-1 == waitpid(pid, &status, 0)
+        || !WIFEXITED(status)
+        || EXIT_SUCCESS != WEXITSTATUS(status)) {
+            ++num_failed;
+        }
+        total_ns += setup_times[i];
+    }
+
+    fprintf(stdout, "\nfork server: %.3fms of shared setup, done once\n",
+        (double) shared_ns / 1e6
+    );
+    for(i = 0; i < num_experiments; ++i) {
+        fprintf(stdout, "    experiment %d (%s): %.3fms of setup\n",
+            i, paths[i], (double) setup_times[i] / 1e6
+        );
+    }
+    fprintf(stdout, "    %.3fms of setup per experiment, %d failed\n",
+        (double) total_ns / num_experiments / 1e6, num_failed
+    );
+
+    return num_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**
+ * Simulate the Santa Claus Problem. Options:
+ *
+ *      -s scenario     run the experiment described by a scenario file; see
+ *                      load_scenario for the keys that it can use.
+ *      -o results      write the experiment's settings, the scenario's hash,
+ *                      build information, and the report to a file.
+ *      -t trace_file   keep the most recent events in a memory-mapped trace
+ *                      file; see tracedump.
+ *      -r num_regions  split the elves up between this many regional santas.
+ *      -T team_size    number of reindeer per sleigh, 0 for the whole herd.
+ *      -S num_sleighs  number of sleighs that can be out at once.
+ *      -D deliveries   stop once this many sleighs have come back.
+ *      -w workload     what the actors do while they wait: the name of a
+ *                      built-in workload, or the path of a shared object
+ *                      exporting a workload_t named santa_workload.
+ *      -L log_level    only narrate at or above this level: debug, info,
+ *                      warn, or none. Levels below LOG_COMPILE_LEVEL are
+ *                      compiled out; build with make LOG_LEVEL=n to change it.
+ *      -q              quiet mode; print aggregate counters every so often
+ *                      instead of narrating.
+ *      -W stall_ms     dump the semaphores, queues, and actor states if no
+ *                      actor changes state for this long; 0 turns it off.
+ *      -Q sample_file  sample how many threads wait on each semaphore every
+ *                      SAMPLE_PERIOD_US and write the time series to a file.
+ *      -p profile_file sample the CPU time every PROFILE_PERIOD_US and write
+ *                      where it went, by actor state and stack, to a file
+ *                      in collapsed-stack form; see prof.c.
+ *      -P              let reindeer interrupt santa while he helps elves.
+ *      -d              have santa serve everything that's ready each time
+ *                      he's woken up.
+ *      -A admission    how elves get into groups: "set", "tickets" to take
+ *                      a ticket whose group is ticket / group size, or
+ *                      "oldest" to have santa help whoever has waited
+ *                      longest.
+ *      -F scenario ... run each scenario in its own forked child, sharing the
+ *                      setup that doesn't depend on the scenario; "-" means
+ *                      the settings given so far. This must be the last
+ *                      option.
+ *      -c ...          simulate using coroutines instead of threads, with one
+ *                      executor per online processor by default. This must
+ *                      be the last option.
+ *      -E ...          run a discrete-event simulation in virtual time instead,
+ *                      with the actors split across partitions that each get
+ *                      a thread, or on the sequential engine if there are no
+ *                      partitions. Its delays and end time come from
+ *                      des.h, so the settings for those are rejected. This
+ *                      must be the last option.
+ *      -C ...          run a thread per core instead, each pinned to its own
+ *                      processor with its own slice of the elves and
+ *                      reindeer, and only talking to santa's core through
+ *                      message queues. This must be the last option.
+ */
+int main(int argc, char *argv[]) {
+    int arg = 1;
+    int i;
+
+    launch_ns = clock_ns();
+    program_name = argv[0];
+    setvbuf(stdout, stdout_buffer, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF,
+        sizeof stdout_buffer
+    );
+    alloc_account("stdout buffer", sizeof stdout_buffer);
+    scenario_init(&scenario);
+
+    while(arg < argc) {
+        if(!strcmp(argv[arg], "-c")
+        || !strcmp(argv[arg], "-E")
+        || !strcmp(argv[arg], "-C")) {
+            backend = 'c' == argv[arg][1] ? BACKEND_COROUTINES
+                    : ('E' == argv[arg][1] ? BACKEND_DES : BACKEND_CORES);
+            if(arg + 1 < argc) {
+                num_initial_elves = atoi(argv[arg + 1]);
+            }
+            if(arg + 2 < argc) {
+                num_initial_reindeer = atoi(argv[arg + 2]);
+            }
+            if(arg + 3 < argc) {
+                num_executors = atoi(argv[arg + 3]);
+            }
+            break;
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-F")) {
+            return fork_server(&(argv[arg + 1]), argc - arg - 1);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-s")) {
+            load_scenario(argv[arg + 1]);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-o")) {
+            results_path = argv[arg + 1];
+
+        } else if(!strcmp(argv[arg], "-q")) {
+            quiet = 1;
+            arg -= 1;
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-L")) {
+            for(i = 0; NULL != log_level_names[i]; ++i) {
+                if(!strcmp(argv[arg + 1], log_level_names[i])) {
+                    break;
+                }
+            }
+            if(NULL == log_level_names[i]) {
+                return usage(argv[0]);
+            }
+            log_level = i;
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-W")) {
+            watchdog_stall_ms = atoi(argv[arg + 1]);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-Q")) {
+            sample_path = argv[arg + 1];
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-p")) {
+            profile_path = argv[arg + 1];
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-A")) {
+            for(i = 0; NULL != admission_names[i]; ++i) {
+                if(!strcmp(argv[arg + 1], admission_names[i])) {
+                    break;
+                }
+            }
+            if(NULL == admission_names[i]) {
+                return usage(argv[0]);
+            }
+            admission = (admission_t) i;
+
+        } else if(!strcmp(argv[arg], "-d")) {
+            drain = 1;
+            arg -= 1;
+
+        } else if(!strcmp(argv[arg], "-P")) {
+            preemption = 1;
+            arg -= 1;
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-t")) {
+            trace_open(
+                argv[arg + 1], TRACE_DEFAULT_LANES, TRACE_DEFAULT_EVENTS_PER_LANE
+            );
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-r")) {
+            num_regions = atoi(argv[arg + 1]);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-T")) {
+            team_size = atoi(argv[arg + 1]);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-S")) {
+            num_sleighs = atoi(argv[arg + 1]);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-D")) {
+            max_deliveries = atoi(argv[arg + 1]);
+
+        } else if(arg + 1 < argc && !strcmp(argv[arg], "-w")) {
+            workload_name = argv[arg + 1];
+
+        } else {
+            return usage(argv[0]);
+        }
+        arg += 2;
+    }
+
+    return run_experiment();
+}
@@ -0,0 +1,570 @@
+/*
+ * prof.c
+ *
+ *     Version: $Id$
+ *
+ * Library for finding out which actor states the CPU time goes to. A
+ * profiler outside of the process sees semop and random_wait, but not
+ * whether an elf was in line or santa was helping it, so each thread keeps
+ * its actor's current state in a thread-local word, which prof_enter sets,
+ * and a SIGPROF timer interrupts whichever thread is using the CPU once per
+ * period of CPU time. The signal handler reads the interrupted thread's
+ * state and, if asked to, the innermost frames of its stack, and counts the
+ * pair in a fixed-size open-addressed table using only atomics, so it never
+ * takes a lock or allocates. Threads that aren't actors, such as the
+ * watchdog, are counted as "untracked".
+ *
+ * Since the timer counts CPU time, a thread that is blocked in the kernel,
+ * e.g. waiting on a semaphore, is never sampled; a state that's all waiting
+ * shows up only as the time spent getting into and out of the wait.
+ *
+ * Once stopped, the table is written out in collapsed-stack form, one line
+ * per distinct stack with the root first, ready for flamegraph.pl:
+ *
+ *      actor;state;outer_function;...;inner_function count
+ *
+ * so that the actor and its state are the bottom two levels of the flame
+ * graph, and grepping for "^elf;in-line;" gives the profile of one state.
+ * Function names come from dladdr, or, for the static functions that dladdr
+ * can't see, from the program's own symbol table. Frames in stripped
+ * objects are written as their object and offset, e.g. libc.so.6+0x891f4,
+ * which addr2line can resolve against a copy with symbols.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+#include "alloc.h"
+#include "prof.h"
+
+/* frames that backtrace sees before the interrupted one: the signal handler
+ * and the kernel's signal trampoline. */
+#define PROF_SKIP 2
+
+/* most slots looked at for a stack before its sample is dropped. */
+#define PROF_MAX_PROBES 64
+
+/* longest function name written out per frame. */
+#define PROF_MAX_NAME_LENGTH 96
+
+/* every (actor, state) pair, plus state 0 for threads that aren't actors. */
+#define PROF_NUM_STATES (1 + TRACE_NUM_ACTORS * TRACE_NUM_EVENTS)
+
+typedef struct {
+    unsigned long key; /* 0 for an empty slot */
+    unsigned long count;
+    int state;
+    int depth;
+    void *frames[PROF_MAX_DEPTH]; /* innermost first */
+} prof_entry_t;
+
+/* one line of the collapsed output, before duplicates are merged. */
+typedef struct {
+    char *stack;
+    unsigned long count;
+} prof_line_t;
+
+/* a function in the program's symbol table, at an offset from where the
+ * program is loaded. */
+typedef struct {
+    unsigned long start;
+    unsigned long size;
+    const char *name;
+} prof_symbol_t;
+
+static __thread int thread_state = 0;
+
+static prof_entry_t *table = NULL;
+static unsigned long state_samples[PROF_NUM_STATES];
+static unsigned long num_dropped = 0;
+static unsigned long num_stacks = 0;
+
+static const char *profile_path = NULL;
+static unsigned long sample_period_us = 0;
+static int stack_depth = 0;
+static int is_running = 0;
+
+/* the program's functions, sorted by start, and where their names live. */
+static prof_symbol_t *symbols = NULL;
+static int num_symbols = 0;
+static void *image = NULL;
+static size_t image_size = 0;
+static char *program_base = NULL;
+
+/**
+ * Note that the calling thread's actor has moved to a new state. This is a
+ * single thread-local store, so it's safe to call on every state change
+ * whether or not the profiler is running.
+ */
+void prof_enter(const trace_actor_t actor, const trace_event_t state) {
+    thread_state = 1 + (int) actor * TRACE_NUM_EVENTS + (int) state;
+}
+
+/**
+ * Get the key of a (state, stack) pair, which is never 0.
+ */
+static unsigned long key_of(const int state, void **frames, const int depth) {
+    unsigned long key = 14695981039346656037UL ^ (unsigned long) state;
+    int i;
+
+    for(i = 0; i < depth; ++i) {
+        key = (key ^ (unsigned long) frames[i]) * 1099511628211UL;
+    }
+    return key | 1UL;
+}
+
+/**
+ * Count a (state, stack) pair in the table. Safe to call from a signal
+ * handler on any number of threads at once.
+ */
+static void count_stack(const int state, void **frames, const int depth) {
+    const unsigned long key = key_of(state, frames, depth);
+    prof_entry_t *entry;
+    unsigned long seen;
+    int probe;
+    int i;
+
+    for(probe = 0; probe < PROF_MAX_PROBES; ++probe) {
+        entry = &(table[(key + (unsigned long) probe) % PROF_TABLE_SIZE]);
+        seen = __atomic_load_n(&(entry->key), __ATOMIC_RELAXED);
+
+        /* whoever claims a slot fills it in; anyone else who finds the key
+         * there only counts. */
+        if(0 == seen && __sync_bool_compare_and_swap(&(entry->key), 0, key)) {
+            entry->state = state;
+            entry->depth = depth;
+            for(i = 0; i < depth; ++i) {
+                entry->frames[i] = frames[i];
+            }
+            __sync_fetch_and_add(&num_stacks, 1);
+            seen = key;
+        } else {
+            seen = __atomic_load_n(&(entry->key), __ATOMIC_RELAXED);
+        }
+
+        if(key == seen) {
+            __sync_fetch_and_add(&(entry->count), 1);
+            return;
+        }
+    }
+
+    __sync_fetch_and_add(&num_dropped, 1);
+}
+
+/**
+ * Take a sample of the interrupted thread. This is the SIGPROF handler.
+ */
+static void take_sample(int sig) {
+    void *frames[PROF_SKIP + PROF_MAX_DEPTH];
+    const int saved_errno = errno;
+    const int state = thread_state;
+    int depth = 0;
+
+    (void) sig;
+
+    __sync_fetch_and_add(&(state_samples[state]), 1);
+    if(stack_depth) {
+        depth = backtrace(&(frames[0]), PROF_SKIP + stack_depth) - PROF_SKIP;
+    }
+    if(0 > depth) {
+        depth = 0;
+    }
+    count_stack(state, &(frames[PROF_SKIP]), depth);
+
+    errno = saved_errno;
+}
+
+/**
+ * Start profiling the process's CPU time. Interrupted system calls are
+ * restarted where the kernel allows it, but semop is never restarted, so
+ * callers must retry it on EINTR; see sem.c.
+ *
+ * Params: - Path of the file to write the collapsed stacks to.
+ *         - CPU time between samples; the kernel rounds this up to its tick.
+ *         - Number of stack frames to keep per sample, from 0 for only the
+ *           actor's state up to PROF_MAX_DEPTH.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void prof_start(const char *path,
+                const unsigned long period_us,
+                const int depth) {
+    struct sigaction action;
+    struct itimerval timer;
+    void *frame;
+
+    assert(NULL != path);
+    assert(0 < period_us);
+    assert(0 <= depth && depth <= PROF_MAX_DEPTH);
+    assert(!is_running);
+
+    profile_path = path;
+    sample_period_us = period_us;
+    stack_depth = depth;
+    table = (prof_entry_t *) alloc_pool(
+        "profile", sizeof(prof_entry_t) * PROF_TABLE_SIZE
+    );
+
+    /* the first backtrace loads the unwinder, which allocates; get that out
+     * of the way before it could happen in the signal handler. */
+    backtrace(&frame, 1);
+
+    memset(&action, 0, sizeof action);
+    action.sa_handler = &take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&(action.sa_mask));
+    if(-1 == sigaction(SIGPROF, &action, NULL)) {
+        perror("prof_start[sigaction]");
+        exit(EXIT_FAILURE);
+    }
+
+    timer.it_interval.tv_sec = (time_t) (period_us / 1000000UL);
+    timer.it_interval.tv_usec = (long) (period_us % 1000000UL);
+    timer.it_value = timer.it_interval;
+    if(-1 == setitimer(ITIMER_PROF, &timer, NULL)) {
+        perror("prof_start[setitimer]");
+        exit(EXIT_FAILURE);
+    }
+    is_running = 1;
+}
+
+/**
+ * Order symbols by where they start.
+ */
+static int compare_symbols(const void *a, const void *b) {
+    const prof_symbol_t *sa = (const prof_symbol_t *) a;
+    const prof_symbol_t *sb = (const prof_symbol_t *) b;
+    if(sa->start != sb->start) {
+        return sa->start < sb->start ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Read in the functions from the program's symbol table, which, unlike the
+ * dynamic symbol table that dladdr uses, includes the static ones. If the
+ * program has no symbol table then nothing is read in and frames fall back
+ * to offsets.
+ */
+static void load_symbols(void) {
+    const Elf64_Ehdr *header;
+    const Elf64_Shdr *sections;
+    const Elf64_Sym *table_symbols;
+    const char *names;
+    struct stat status;
+    Dl_info info;
+    int num_table_symbols;
+    int fd;
+    int i;
+    int j;
+
+    /* any address in the program will do to find where it's loaded. */
+    if(!dladdr((void *) &symbols, &info)) {
+        return;
+    }
+    program_base = (char *) info.dli_fbase;
+
+    fd = open("/proc/self/exe", O_RDONLY);
+    if(-1 == fd) {
+        return;
+    }
+    if(-1 == fstat(fd, &status)) {
+        close(fd);
+        return;
+    }
+    image_size = (size_t) status.st_size;
+    image = mmap(NULL, image_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == image) {
+        image = NULL;
+        return;
+    }
+
+    header = (const Elf64_Ehdr *) image;
+    if(image_size < sizeof *header
+    || memcmp(header->e_ident, ELFMAG, SELFMAG)
+    || ELFCLASS64 != header->e_ident[EI_CLASS]) {
+        return;
+    }
+    sections = (const Elf64_Shdr *) ((char *) image + header->e_shoff);
+
+    for(i = 0; i < header->e_shnum; ++i) {
+        if(SHT_SYMTAB != sections[i].sh_type) {
+            continue;
+        }
+
+        table_symbols = (const Elf64_Sym *) (
+            (char *) image + sections[i].sh_offset
+        );
+        names = (char *) image + sections[sections[i].sh_link].sh_offset;
+        num_table_symbols = (int) (sections[i].sh_size / sizeof(Elf64_Sym));
+
+        symbols = (prof_symbol_t *) malloc(
+            sizeof(prof_symbol_t) * num_table_symbols
+        );
+        if(NULL == symbols) {
+            return;
+        }
+
+        for(j = 0; j < num_table_symbols; ++j) {
+            if(STT_FUNC != ELF64_ST_TYPE(table_symbols[j].st_info)
+            || !table_symbols[j].st_value) {
+                continue;
+            }
+            symbols[num_symbols].start = table_symbols[j].st_value;
+            symbols[num_symbols].size = table_symbols[j].st_size;
+            symbols[num_symbols].name = names + table_symbols[j].st_name;
+            ++num_symbols;
+        }
+        qsort(symbols, (size_t) num_symbols, sizeof(prof_symbol_t),
+            &compare_symbols
+        );
+        return;
+    }
+}
+
+/**
+ * Find the program's function that an address is in.
+ *
+ * Returns: the function's name, or NULL if the address isn't in one.
+ */
+static const char *find_symbol(const char *address) {
+    const unsigned long offset = (unsigned long) (address - program_base);
+    int low = 0;
+    int high = num_symbols - 1;
+    int middle;
+
+    /* find the last function that starts at or before the address. */
+    while(low <= high) {
+        middle = low + (high - low) / 2;
+        if(symbols[middle].start <= offset) {
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    if(0 > high || offset >= symbols[high].start + symbols[high].size) {
+        return NULL;
+    }
+    return symbols[high].name;
+}
+
+/**
+ * Free the program's symbols.
+ */
+static void unload_symbols(void) {
+    free(symbols);
+    symbols = NULL;
+    num_symbols = 0;
+    if(NULL != image) {
+        munmap(image, image_size);
+        image = NULL;
+    }
+}
+
+/**
+ * Write out the name of a frame: its function's name if it can be found,
+ * its object and offset if not, or just its address.
+ *
+ * Params: - The frame's address.
+ *         - 1 if the address is a return address, 0 if it was interrupted.
+ *         - Where to write it.
+ */
+static void write_frame(void *frame, const int is_return, FILE *out) {
+    char *address = (char *) frame;
+    const char *object;
+    const char *name = NULL;
+    Dl_info info;
+
+    /* a return address can be the first byte of the next function. */
+    if(is_return) {
+        --address;
+    }
+
+    if(!dladdr(address, &info) || NULL == info.dli_fname) {
+        fprintf(out, ";0x%lx", (unsigned long) address);
+        return;
+    }
+
+    if(NULL != info.dli_sname) {
+        name = info.dli_sname;
+    } else if(program_base == (char *) info.dli_fbase) {
+        name = find_symbol(address);
+    }
+
+    if(NULL != name) {
+        fprintf(out, ";%.*s", PROF_MAX_NAME_LENGTH, name);
+    } else {
+        object = strrchr(info.dli_fname, '/');
+        fprintf(out, ";%.*s+0x%lx",
+            PROF_MAX_NAME_LENGTH,
+            NULL == object ? info.dli_fname : object + 1,
+            (unsigned long) (address - (char *) info.dli_fbase)
+        );
+    }
+}
+
+/**
+ * Write out the name of a state, as actor and state.
+ */
+static void write_state(const int state, const char *separator, FILE *out) {
+    if(0 == state) {
+        fprintf(out, "untracked");
+    } else {
+        fprintf(out, "%s%s%s",
+            trace_actor_name((state - 1) / TRACE_NUM_EVENTS),
+            separator,
+            trace_event_name((state - 1) % TRACE_NUM_EVENTS)
+        );
+    }
+}
+
+/**
+ * Order lines by their stacks.
+ */
+static int compare_stacks(const void *a, const void *b) {
+    return strcmp(((const prof_line_t *) a)->stack,
+                  ((const prof_line_t *) b)->stack);
+}
+
+/**
+ * Write the counted stacks out in collapsed form. Different addresses in the
+ * same function have different keys but the same name, so the lines are
+ * sorted and the duplicates merged.
+ */
+static void write_profile(FILE *out) {
+    prof_line_t *lines;
+    prof_entry_t *entry;
+    FILE *line;
+    size_t length;
+    int num_lines = 0;
+    int i;
+    int j;
+
+    lines = (prof_line_t *) malloc(sizeof(prof_line_t) * PROF_TABLE_SIZE);
+    if(NULL == lines) {
+        perror("prof_stop[malloc]");
+        exit(EXIT_FAILURE);
+    }
+    load_symbols();
+
+    for(i = 0; i < PROF_TABLE_SIZE; ++i) {
+        entry = &(table[i]);
+        if(!entry->key || !entry->count) {
+            continue;
+        }
+
+        line = open_memstream(&(lines[num_lines].stack), &length);
+        if(NULL == line) {
+            perror("prof_stop[open_memstream]");
+            exit(EXIT_FAILURE);
+        }
+        write_state(entry->state, ";", line);
+        for(j = entry->depth - 1; j >= 0; --j) {
+            write_frame(entry->frames[j], 0 < j, line);
+        }
+        fclose(line);
+        lines[num_lines++].count = entry->count;
+    }
+
+    unload_symbols();
+    qsort(lines, (size_t) num_lines, sizeof(prof_line_t), &compare_stacks);
+
+    for(i = 0; i < num_lines; i = j) {
+        for(j = i + 1; j < num_lines
+                    && !strcmp(lines[i].stack, lines[j].stack); ++j) {
+            lines[i].count += lines[j].count;
+        }
+        fprintf(out, "%s %lu\n", lines[i].stack, lines[i].count);
+    }
+
+    for(i = 0; i < num_lines; ++i) {
+        free(lines[i].stack);
+    }
+    free(lines);
+}
+
+/**
+ * Stop profiling and write out the collapsed stacks.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void prof_stop(void) {
+    struct itimerval timer;
+    FILE *out;
+
+    if(!is_running) {
+        return;
+    }
+
+    memset(&timer, 0, sizeof timer);
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+    is_running = 0;
+
+    out = fopen(profile_path, "w");
+    if(NULL == out) {
+        perror("prof_stop[fopen]");
+        exit(EXIT_FAILURE);
+    }
+    write_profile(out);
+    fclose(out);
+}
+
+/**
+ * Order states from the most samples to the fewest.
+ */
+static int compare_samples(const void *a, const void *b) {
+    const unsigned long sa = state_samples[*((const int *) a)];
+    const unsigned long sb = state_samples[*((const int *) b)];
+    if(sa != sb) {
+        return sa > sb ? -1 : 1;
+    }
+    return *((const int *) a) - *((const int *) b);
+}
+
+/**
+ * Print out the states that took the most CPU time.
+ */
+void prof_report(FILE *out) {
+    int sorted[PROF_NUM_STATES];
+    unsigned long num_samples = 0;
+    int i;
+
+    for(i = 0; i < PROF_NUM_STATES; ++i) {
+        sorted[i] = i;
+        num_samples += state_samples[i];
+    }
+    if(!num_samples) {
+        return;
+    }
+    qsort(sorted, PROF_NUM_STATES, sizeof(int), &compare_samples);
+
+    fprintf(out,
+        "busiest actor states over %lu CPU samples, one per %lu us "
+        "(%lu stacks, %lu dropped):\n",
+        num_samples, sample_period_us, num_stacks, num_dropped
+    );
+    for(i = 0; i < PROF_NUM_STATES && i < PROF_REPORT_SIZE; ++i) {
+        if(!state_samples[sorted[i]]) {
+            break;
+        }
+        fprintf(out, "    ");
+        write_state(sorted[i], " ", out);
+        fprintf(out, ": %lu samples, %.1f%%\n",
+            state_samples[sorted[i]],
+            100.0 * state_samples[sorted[i]] / num_samples
+        );
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * prof.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+#include "trace.h"
+
+/* most stack frames kept per sample, under the actor's state. */
+#define PROF_MAX_DEPTH 32
+
+/* distinct (state, stack) pairs that can be counted; samples with a new pair
+ * past this many are only counted toward their state. */
+#define PROF_TABLE_SIZE 8192
+
+/* number of states listed in the report, busiest first. */
+#define PROF_REPORT_SIZE 8
+
+void prof_enter(const trace_actor_t actor, const trace_event_t state);
+void prof_start(const char *path,
+                const unsigned long period_us,
+                const int depth);
+void prof_stop(void);
+void prof_report(FILE *out);
+
+#endif /* PROF_H_ */
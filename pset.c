@@ -0,0 +1,386 @@
+/*
+ * pset.c
+ *
+ *     Version: $Id$
+ *
+ * Library implementing a priority set using locks. Like a set_t, a given item
+ * only ever has one slot, and putting an item in that's already there doesn't
+ * change anything, not even how long it has been there. Unlike a set_t, items
+ * come out oldest first: each item is kept in a binary min-heap by the time
+ * that it was put in, and each slot knows where its item is in the heap, so
+ * inserting and taking are O(log n) and finding the oldest is O(1). Items put
+ * in at the same tick come out smallest first.
+ *
+ * As with a set_t, readers that only want to look never take the lock: a
+ * writer makes the sequence number odd while it changes the heap, and a
+ * reader copies the heap out and tries again if the sequence was odd or
+ * changed while it was copying.
+ */
+
+#include "pset.h"
+#include "alloc.h"
+#include "clock.h"
+
+typedef struct {
+    unsigned long inserted;
+    int item;
+} pset_entry_t;
+
+struct pset {
+    sem_t write_lock;
+    sem_set_t semaphore_set;
+
+    /* the items, by insertion time; the oldest is first. */
+    pset_entry_t *heap;
+
+    /* where each slot's item is in the heap, plus one; 0 for no item. */
+    int *positions;
+
+    int num_slots;
+    int cardinality;
+
+    /* odd while the heap is being changed; only written with the lock. */
+    unsigned int sequence;
+};
+
+/**
+ * Allocate a new fixed-size priority set.
+ *
+ * Params: - The size of the set.
+ */
+pset_t pset_alloc(const int num_slots) {
+    pset_t pset = NULL;
+    size_t size = sizeof(struct pset)
+                + sizeof(pset_entry_t) * num_slots
+                + sizeof(int) * num_slots;
+
+    assert(0 < num_slots);
+
+    pset = (pset_t) malloc(size);
+    if(NULL == pset) {
+        return NULL;
+    }
+    alloc_account("priority sets", size);
+
+    /* the heap is unsigned longs and ints, so it goes first. */
+    pset->heap = (pset_entry_t *) (((char *) pset) + sizeof(struct pset));
+    pset->positions = (int *) &(pset->heap[num_slots]);
+    pset->num_slots = num_slots;
+    pset->cardinality = 0;
+    pset->sequence = 0;
+    memset(pset->positions, 0, sizeof(int) * num_slots);
+
+    sem_fill_set(&(pset->semaphore_set), 1);
+    sem_unpack_set(&(pset->semaphore_set), &(pset->write_lock));
+    sem_init(pset->write_lock, 1);
+
+    return pset;
+}
+
+/**
+ * Free the semaphores at exit. This should only be called within an atexit
+ * handler. This does not actually free the heap object.
+ */
+void pset_exit_free(pset_t pset) {
+    assert(NULL != pset);
+    sem_empty_set(&(pset->semaphore_set));
+}
+
+/**
+ * Free the priority set.
+ */
+void pset_free(pset_t pset) {
+    assert(NULL != pset);
+    pset_exit_free(pset);
+    free(pset);
+}
+
+/**
+ * Check whether or not one entry should come out before another.
+ */
+static int is_older(const pset_entry_t *a, const pset_entry_t *b) {
+    return a->inserted < b->inserted
+        || (a->inserted == b->inserted && a->item < b->item);
+}
+
+/**
+ * Start changing the heap. The write lock must be held.
+ */
+static void write_begin(pset_t pset) {
+    __atomic_store_n(&(pset->sequence), pset->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Finish changing the heap.
+ */
+static void write_end(pset_t pset) {
+    __atomic_store_n(&(pset->sequence), pset->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Change the number of items in the heap. The write lock must be held.
+ */
+static void set_cardinality(pset_t pset, const int cardinality) {
+    __atomic_store_n(&(pset->cardinality), cardinality, __ATOMIC_RELAXED);
+}
+
+/**
+ * Put an entry at a place in the heap, and remember where it is.
+ */
+static void place(pset_t pset, const pset_entry_t entry, const int i) {
+    __atomic_store_n(&(pset->heap[i].inserted), entry.inserted,
+        __ATOMIC_RELAXED
+    );
+    __atomic_store_n(&(pset->heap[i].item), entry.item, __ATOMIC_RELAXED);
+    pset->positions[entry.item] = i + 1;
+}
+
+/**
+ * Move the entry at a place in the heap up until it's in order.
+ */
+static void sift_up(pset_t pset, int i) {
+    const pset_entry_t entry = pset->heap[i];
+    int parent;
+
+    while(0 < i) {
+        parent = (i - 1) / 2;
+        if(!is_older(&entry, &(pset->heap[parent]))) {
+            break;
+        }
+        place(pset, pset->heap[parent], i);
+        i = parent;
+    }
+    place(pset, entry, i);
+}
+
+/**
+ * Move the entry at a place in the heap down until it's in order.
+ */
+static void sift_down(pset_t pset, int i) {
+    const pset_entry_t entry = pset->heap[i];
+    int child;
+
+    while((child = 2 * i + 1) < pset->cardinality) {
+        if(child + 1 < pset->cardinality
+        && is_older(&(pset->heap[child + 1]), &(pset->heap[child]))) {
+            ++child;
+        }
+        if(!is_older(&(pset->heap[child]), &entry)) {
+            break;
+        }
+        place(pset, pset->heap[child], i);
+        i = child;
+    }
+    place(pset, entry, i);
+}
+
+/**
+ * Take the oldest item out of the heap. The heap must not be empty.
+ */
+static int pop_oldest(pset_t pset) {
+    const int item = pset->heap[0].item;
+
+    pset->positions[item] = 0;
+    set_cardinality(pset, pset->cardinality - 1);
+    if(0 < pset->cardinality) {
+        place(pset, pset->heap[pset->cardinality], 0);
+        sift_down(pset, 0);
+    }
+    return item;
+}
+
+/**
+ * Add an item (integer) into the priority set, as of now.
+ *
+ * Returns: the number of items in the set right after the item was added,
+ *          so that exactly one caller sees each size.
+ */
+int pset_insert(pset_t pset, const int item) {
+    pset_entry_t entry;
+    int cardinality;
+
+    assert(NULL != pset);
+    assert(item >= 0 && item < pset->num_slots);
+
+    entry.item = item;
+    entry.inserted = clock_ticks();
+
+    CRITICAL(pset->write_lock, {
+        if(!pset->positions[item]) {
+            write_begin(pset);
+            place(pset, entry, pset->cardinality);
+            set_cardinality(pset, pset->cardinality + 1);
+            sift_up(pset, pset->cardinality - 1);
+            write_end(pset);
+        }
+        cardinality = pset->cardinality;
+    });
+
+    return cardinality;
+}
+
+/**
+ * Remove the oldest item (integer) from the priority set. The set must not be
+ * empty.
+ */
+int pset_take(pset_t pset) {
+    int item = -1;
+    assert(NULL != pset);
+
+    CRITICAL(pset->write_lock, {
+        assert(0 < pset->cardinality);
+        write_begin(pset);
+        item = pop_oldest(pset);
+        write_end(pset);
+    });
+
+    return item;
+}
+
+/**
+ * Remove up to some number of the oldest items from the priority set, all at
+ * once.
+ *
+ * Params: - Pointer to the priority set.
+ *         - Where to put the items, oldest first.
+ *         - Max number of items to take.
+ *
+ * Returns: the number of items taken.
+ */
+int pset_take_oldest(pset_t pset, int *items, const int max_items) {
+    int num_taken = 0;
+    assert(NULL != pset);
+    assert(NULL != items || 0 == max_items);
+
+    CRITICAL(pset->write_lock, {
+        write_begin(pset);
+        while(num_taken < max_items && pset->cardinality) {
+            items[num_taken++] = pop_oldest(pset);
+        }
+        write_end(pset);
+    });
+
+    return num_taken;
+}
+
+/**
+ * Get the number of items currently in the priority set.
+ */
+int pset_cardinality(const pset_t pset) {
+    return __atomic_load_n(&(pset->cardinality), __ATOMIC_RELAXED);
+}
+
+/**
+ * Get how long the oldest item has been in the priority set, without taking
+ * the write lock; only the front of the heap is read, so this is O(1). If the
+ * heap keeps changing for PSET_SNAPSHOT_TRIES tries, then the last age seen
+ * is returned, which was the oldest item's at some point during the call.
+ *
+ * Returns: the oldest item's age in nanoseconds, or 0 if the set is empty.
+ */
+unsigned long pset_oldest_age(const pset_t pset) {
+    unsigned int sequence;
+    unsigned long inserted = 0;
+    int tries;
+
+    assert(NULL != pset);
+
+    for(tries = 0; tries < PSET_SNAPSHOT_TRIES; ++tries) {
+        sequence = __atomic_load_n(&(pset->sequence), __ATOMIC_ACQUIRE);
+        if(sequence & 1) {
+            continue;
+        }
+
+        inserted = pset_cardinality(pset)
+            ? __atomic_load_n(&(pset->heap[0].inserted), __ATOMIC_RELAXED)
+            : 0;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(sequence == __atomic_load_n(&(pset->sequence), __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    return inserted ? clock_ticks_to_ns(clock_ticks() - inserted) : 0;
+}
+
+/**
+ * Copy the items in the heap out, without taking the write lock. The items
+ * are the ones that were in the heap at one moment, even if the heap is
+ * being changed at the same time.
+ *
+ * Params: - Pointer to the priority set being looked at.
+ *         - Where to put the items, in heap order; this must have room for
+ *           every slot.
+ *         - Where to put when the oldest item was inserted.
+ *
+ * Returns: the number of items, or -1 if the heap kept changing for
+ *          PSET_SNAPSHOT_TRIES tries, in which case the copy is garbage.
+ */
+static int snapshot(const pset_t pset, int *items, unsigned long *oldest) {
+    unsigned int sequence;
+    int cardinality;
+    int tries;
+    int i;
+
+    for(tries = 0; tries < PSET_SNAPSHOT_TRIES; ++tries) {
+        sequence = __atomic_load_n(&(pset->sequence), __ATOMIC_ACQUIRE);
+        if(sequence & 1) {
+            continue;
+        }
+
+        cardinality = pset_cardinality(pset);
+        for(i = 0; i < cardinality && i < pset->num_slots; ++i) {
+            items[i] = __atomic_load_n(&(pset->heap[i].item), __ATOMIC_RELAXED);
+        }
+        *oldest = __atomic_load_n(&(pset->heap[0].inserted), __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(sequence == __atomic_load_n(&(pset->sequence), __ATOMIC_RELAXED)) {
+            return cardinality;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Print out the items in the priority set, in heap order, along with how
+ * long the oldest has been there. Like set_print, this doesn't take the write
+ * lock, so that it can be used while something is stuck holding the lock. If
+ * a writer is stuck in the middle of changing the heap, then what the heap
+ * says is printed anyway, and marked as such.
+ */
+void pset_print(pset_t pset, FILE *out) {
+    unsigned long oldest = 0;
+    int *items;
+    int cardinality;
+    int i;
+    assert(NULL != pset);
+
+    items = (int *) alloca(sizeof(int) * pset->num_slots);
+    cardinality = snapshot(pset, items, &oldest);
+
+    fprintf(out, "{");
+    if(0 > cardinality) {
+        cardinality = pset_cardinality(pset);
+        for(i = 0; i < cardinality && i < pset->num_slots; ++i) {
+            fprintf(out, " %d",
+                __atomic_load_n(&(pset->heap[i].item), __ATOMIC_RELAXED)
+            );
+        }
+        fprintf(out, " } (%d items, changing)", cardinality);
+        return;
+    }
+
+    for(i = 0; i < cardinality; ++i) {
+        fprintf(out, " %d", items[i]);
+    }
+    fprintf(out, " } (%d items, oldest %.3fms)",
+        cardinality,
+        cardinality
+        ? (double) clock_ticks_to_ns(clock_ticks() - oldest) / 1000000.0
+        : 0.0
+    );
+}
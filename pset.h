@@ -0,0 +1,33 @@
+/*
+ * pset.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef PSET_H_
+#define PSET_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "assert.h"
+#include "sem.h"
+
+/* how many times pset_print tries to get a consistent copy of the heap
+ * before printing whatever it sees. */
+#define PSET_SNAPSHOT_TRIES 1000
+
+typedef struct pset *pset_t;
+
+pset_t pset_alloc(const int num_slots);
+void pset_exit_free(pset_t pset);
+void pset_free(pset_t pset);
+int pset_insert(pset_t pset, const int item);
+int pset_take(pset_t pset);
+int pset_take_oldest(pset_t pset, int *items, const int max_items);
+int pset_cardinality(const pset_t pset);
+unsigned long pset_oldest_age(const pset_t pset);
+void pset_print(pset_t pset, FILE *out);
+
+#endif /* PSET_H_ */
@@ -0,0 +1,242 @@
+/*
+ * sampler.c
+ *
+ *     Version: $Id$
+ *
+ * Library for finding out where threads pile up without touching the
+ * threads. The kernel already counts how many threads are waiting on each
+ * SysV semaphore (GETNCNT) or waiting for it to reach zero (GETZCNT), so a
+ * sampling thread reads those counts, along with each semaphore's value, for
+ * every watched semaphore once per period and writes them out as a time
+ * series. The file is tab-separated with one row per sample and three columns
+ * per semaphore:
+ *
+ *      time_s  <name>.value  <name>.waiting  <name>.zero  ...
+ *
+ * sampler_report summarizes the series by listing the semaphores with the
+ * deepest average queues, which is usually the bottleneck.
+ *
+ * Waits that don't go through a SysV semaphore, such as the futex-based
+ * groups in group.c, have no kernel counters, so they keep their own count
+ * of waiters instead, which is sampled the same way but has no value or zero
+ * columns (they're written as "-").
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "sampler.h"
+
+typedef struct {
+    sem_t sem;
+
+    /* the waiter count to read instead of the semaphore's, if any. */
+    const int *num_waiting;
+
+    char name[SAMPLER_MAX_NAME_LENGTH];
+
+    /* running totals over all samples. */
+    unsigned long total_waiting;
+    int max_waiting;
+} watched_t;
+
+static watched_t watched[SAMPLER_MAX_SEMAPHORES];
+static int num_watched = 0;
+
+static FILE *series = NULL;
+static struct timespec period;
+static pthread_t sampler;
+static int is_running = 0;
+static int should_stop = 0;
+static unsigned long num_samples = 0;
+static unsigned long start_ns = 0;
+
+/**
+ * Add a new entry to the ones that are sampled.
+ */
+static watched_t *add_watched(const char *name) {
+    watched_t *w;
+
+    assert(!is_running);
+    assert(NULL != name);
+    assert(num_watched < SAMPLER_MAX_SEMAPHORES);
+
+    w = &(watched[num_watched++]);
+    w->num_waiting = NULL;
+    strncpy(&(w->name[0]), name, SAMPLER_MAX_NAME_LENGTH - 1);
+    w->name[SAMPLER_MAX_NAME_LENGTH - 1] = '\0';
+    w->total_waiting = 0;
+    w->max_waiting = 0;
+    return w;
+}
+
+/**
+ * Add a semaphore to the ones that are sampled. This must be called before
+ * sampler_start.
+ *
+ * Params: - The semaphore.
+ *         - Name of the semaphore to use in the time series and report.
+ */
+void sampler_watch(sem_t sem, const char *name) {
+    add_watched(name)->sem = sem;
+}
+
+/**
+ * Add a count of waiting threads that something other than a semaphore keeps
+ * to the ones that are sampled. This must be called before sampler_start, and
+ * the count must outlive the sampler.
+ *
+ * Params: - The count, which is only ever read atomically.
+ *         - Name to use in the time series and report.
+ */
+void sampler_watch_count(const int *num_waiting, const char *name) {
+    assert(NULL != num_waiting);
+    add_watched(name)->num_waiting = num_waiting;
+}
+
+/**
+ * Take one sample of every watched semaphore and write it out as a row.
+ */
+static void take_sample(void) {
+    sem_counts_t counts;
+    watched_t *w;
+    int i;
+
+    fprintf(series, "%.6f",
+        (double) (clock_ns() - start_ns) / NS_PER_SEC
+    );
+
+    for(i = 0; i < num_watched; ++i) {
+        w = &(watched[i]);
+        if(NULL != w->num_waiting) {
+            counts.num_waiting =
+                __atomic_load_n(w->num_waiting, __ATOMIC_RELAXED);
+        } else if(-1 == sem_counts(w->sem, &counts)) {
+            fprintf(series, "\t-\t-\t-");
+            continue;
+        }
+
+        w->total_waiting += (unsigned long) counts.num_waiting;
+        if(counts.num_waiting > w->max_waiting) {
+            w->max_waiting = counts.num_waiting;
+        }
+
+        if(NULL != w->num_waiting) {
+            fprintf(series, "\t-\t%d\t-", counts.num_waiting);
+        } else {
+            fprintf(series, "\t%d\t%d\t%d",
+                counts.value, counts.num_waiting, counts.num_waiting_for_zero
+            );
+        }
+    }
+
+    fprintf(series, "\n");
+    ++num_samples;
+}
+
+/**
+ * Sample until told to stop.
+ */
+static void *sample(void *_) {
+    while(!__atomic_load_n(&should_stop, __ATOMIC_ACQUIRE)) {
+        take_sample();
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * Start sampling the watched semaphores.
+ *
+ * Params: - Path of the file to write the time series to.
+ *         - Time between samples.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void sampler_start(const char *path, const unsigned long period_ns) {
+    int i;
+
+    assert(NULL != path);
+    assert(0 < period_ns);
+    assert(!is_running);
+
+    series = fopen(path, "w");
+    if(NULL == series) {
+        perror("sampler_start[fopen]");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(series, "time_s");
+    for(i = 0; i < num_watched; ++i) {
+        fprintf(series, "\t%s.value\t%s.waiting\t%s.zero",
+            watched[i].name, watched[i].name, watched[i].name
+        );
+    }
+    fprintf(series, "\n");
+
+    period.tv_sec = (time_t) (period_ns / NS_PER_SEC);
+    period.tv_nsec = (long) (period_ns % NS_PER_SEC);
+    start_ns = clock_ns();
+
+    if(0 != pthread_create(&sampler, NULL, &sample, NULL)) {
+        perror("sampler_start[pthread_create]");
+        exit(EXIT_FAILURE);
+    }
+    is_running = 1;
+}
+
+/**
+ * Stop sampling and close the time series. This must be called before the
+ * watched semaphores are removed.
+ */
+void sampler_stop(void) {
+    if(!is_running) {
+        return;
+    }
+    __atomic_store_n(&should_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sampler, NULL);
+    fclose(series);
+    is_running = 0;
+}
+
+/**
+ * Order watched semaphores from the deepest average queue to the shallowest.
+ */
+static int compare_depths(const void *a, const void *b) {
+    const watched_t *wa = *((const watched_t **) a);
+    const watched_t *wb = *((const watched_t **) b);
+    if(wa->total_waiting != wb->total_waiting) {
+        return wa->total_waiting > wb->total_waiting ? -1 : 1;
+    }
+    return wb->max_waiting - wa->max_waiting;
+}
+
+/**
+ * Print out the semaphores with the deepest queues.
+ */
+void sampler_report(FILE *out) {
+    watched_t *sorted[SAMPLER_MAX_SEMAPHORES];
+    int i;
+
+    if(!num_samples) {
+        return;
+    }
+
+    for(i = 0; i < num_watched; ++i) {
+        sorted[i] = &(watched[i]);
+    }
+    qsort(sorted, (size_t) num_watched, sizeof(watched_t *), &compare_depths);
+
+    fprintf(out, "deepest wait queues over %lu samples:\n", num_samples);
+    for(i = 0; i < num_watched && i < SAMPLER_REPORT_SIZE; ++i) {
+        fprintf(out, "    %-24s mean %.2f waiting, max %d\n",
+            sorted[i]->name,
+            (double) sorted[i]->total_waiting / num_samples,
+            sorted[i]->max_waiting
+        );
+    }
+}
@@ -0,0 +1,28 @@
+/*
+ * sampler.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+#include "sem.h"
+
+#define SAMPLER_MAX_SEMAPHORES 256
+#define SAMPLER_MAX_NAME_LENGTH 32
+
+/* number of semaphores listed in the report, deepest queues first. */
+#define SAMPLER_REPORT_SIZE 5
+
+void sampler_watch(sem_t sem, const char *name);
+void sampler_watch_count(const int *num_waiting, const char *name);
+void sampler_start(const char *path, const unsigned long period_ns);
+void sampler_stop(void);
+void sampler_report(FILE *out);
+
+#endif /* SAMPLER_H_ */
@@ -0,0 +1,280 @@
+/*
+ * santa_coro.c
+ *
+ *     Version: $Id$
+ *
+ * The Santa Claus Problem again, but with santa, the elves, and the reindeer
+ * as coroutines instead of threads. The protocol is the same as the threaded
+ * one in main.c, so see there for why it works; the differences are that the
+ * elves line up in a coro_group_t instead of a set_t plus a semaphore per elf,
+ * that the reindeer leave together through a barrier, and that "work" is a
+ * number of trips through the executor instead of a busy wait, as a busy wait
+ * would hold up every other coroutine on the same executor.
+ *
+ * Each actor costs sizeof(coro_elf_t) or sizeof(coro_reindeer_t) bytes and no
+ * thread, so millions of elves fit comfortably in memory.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "assert.h"
+#include "coro.h"
+#include "santa_coro.h"
+
+/* max number of trips through the executor that an elf works for, or that a
+ * reindeer spends on vacation. */
+#define MAX_WORK_ROUNDS 16
+#define MAX_VACATION_ROUNDS 64
+
+/* only narrate what every actor is doing for small populations. */
+#define MAX_VERBOSE_ACTORS 64
+
+typedef struct {
+    coro_t coro;
+    int id;
+    unsigned int seed;
+    int rounds_left;
+} coro_elf_t;
+
+typedef struct {
+    coro_t coro;
+    int id;
+    unsigned int seed;
+    int rounds_left;
+    int is_last;
+} coro_reindeer_t;
+
+typedef struct {
+    coro_t coro;
+    int i;
+    int num_taken;
+    coro_t *group[CORO_MAX_GROUP_SIZE];
+} coro_santa_t;
+
+/* the coroutine versions of the semaphores in main.c */
+static coro_sem_t santa_busy_mutex;
+static coro_sem_t santa_sleep_mutex;
+static coro_sem_t reindeer_counting_sem;
+static coro_sem_t elf_counting_sem;
+
+/* elves waiting for santa, and the reindeer getting hitched. */
+static coro_group_t elves_waiting;
+static coro_barrier_t hitching;
+
+static int num_reindeer = 0;
+static int group_size = 0;
+static int num_reindeer_waiting = 0;
+static int num_elves_being_helped = 0;
+static unsigned long num_groups_helped = 0;
+static int verbose = 0;
+
+/**
+ * Get the number of executor rounds that some piece of work takes.
+ */
+static int random_rounds(unsigned int *seed, const int max_rounds) {
+    *seed = *seed * 1103515245U + 12345U;
+    return 1 + (int) ((*seed >> 16) % (unsigned int) max_rounds);
+}
+
+/**
+ * Santa coroutine.
+ */
+static int santa(coro_t *coro) {
+    coro_santa_t *self = (coro_santa_t *) coro;
+
+    CORO_BEGIN(coro);
+    while(1) {
+
+        /* wait until santa isn't busy to continue */
+        CORO_AWAIT_SEM(coro, &santa_busy_mutex);
+        if(verbose) {
+            fprintf(stdout, "Santa: zzZZzZzzzZZzzz (sleeping) \n");
+        }
+        coro_sem_signal(&santa_busy_mutex, 1);
+
+        CORO_AWAIT_SEM(coro, &santa_sleep_mutex);
+
+        if(num_reindeer <= num_reindeer_waiting) {
+            CORO_AWAIT_SEM(coro, &santa_busy_mutex);
+            fprintf(stdout, "Santa: preparing the sleigh. \n");
+            coro_sem_signal(&reindeer_counting_sem, num_reindeer);
+            break;
+
+        } else if(group_size <= coro_group_count(&elves_waiting)) {
+            CORO_AWAIT_SEM(coro, &santa_busy_mutex);
+            num_elves_being_helped = group_size;
+            ++num_groups_helped;
+
+            self->num_taken = coro_group_take(
+                &elves_waiting, &(self->group[0]), group_size
+            );
+
+            for(self->i = 0; self->i < self->num_taken; ++(self->i)) {
+                if(verbose) {
+                    fprintf(stdout, "Santa: helping elf: %d. \n",
+                        ((coro_elf_t *) self->group[self->i])->id
+                    );
+                }
+                coro_schedule(self->group[self->i]);
+            }
+        }
+    }
+    CORO_END(coro);
+}
+
+/**
+ * A single elf coroutine.
+ */
+static int elf(coro_t *coro) {
+    coro_elf_t *self = (coro_elf_t *) coro;
+
+    CORO_BEGIN(coro);
+    while(1) {
+        if(verbose) {
+            fprintf(stdout, "Elf %d is working... \n", self->id);
+        }
+
+        self->rounds_left = random_rounds(&(self->seed), MAX_WORK_ROUNDS);
+        while(0 < --(self->rounds_left)) {
+            CORO_YIELD(coro);
+        }
+
+        CORO_AWAIT_SEM(coro, &elf_counting_sem);
+        CORO_AWAIT_GROUP(coro, &elves_waiting);
+
+        if(verbose) {
+            fprintf(stdout, "Elf %d got santa's help! \n", self->id);
+        }
+
+        /* unlock santa; signal that elves can line up again */
+        if(0 == __sync_sub_and_fetch(&num_elves_being_helped, 1)) {
+            coro_sem_signal(&santa_busy_mutex, 1);
+            coro_sem_signal(&elf_counting_sem, group_size);
+        }
+    }
+    CORO_END(coro);
+}
+
+/**
+ * A single reindeer coroutine.
+ */
+static int reindeer(coro_t *coro) {
+    coro_reindeer_t *self = (coro_reindeer_t *) coro;
+
+    CORO_BEGIN(coro);
+
+    self->rounds_left = random_rounds(&(self->seed), MAX_VACATION_ROUNDS);
+    while(0 < --(self->rounds_left)) {
+        CORO_YIELD(coro);
+    }
+
+    if(verbose) {
+        fprintf(stdout, "Reindeer %d is back from the Tropics.\n", self->id);
+    }
+
+    if(num_reindeer == __sync_add_and_fetch(&num_reindeer_waiting, 1)) {
+        fprintf(stdout,
+            "Reindeer %d: I'm the last one; I'll get santa!\n", self->id
+        );
+        coro_sem_signal(&santa_sleep_mutex, 1);
+    }
+
+    CORO_AWAIT_SEM(coro, &reindeer_counting_sem);
+    if(verbose) {
+        fprintf(stdout,
+            "Reindeer %d is getting hitched to the sleigh! \n", self->id
+        );
+    }
+
+    CORO_AWAIT_BARRIER(coro, &hitching, &(self->is_last));
+    if(self->is_last) {
+        fprintf(stdout, "Santa: Ho ho ho! Off to deliver presents! \n");
+        coro_stop();
+    }
+
+    CORO_END(coro);
+}
+
+/**
+ * Simulate the Santa Claus Problem using coroutines.
+ *
+ * Params: - Number of elves.
+ *         - Number of reindeer.
+ *         - Number of elves that santa helps at once; at most
+ *           CORO_MAX_GROUP_SIZE.
+ *         - Seed for the elves' and reindeer's random rounds.
+ *         - Number of executor threads; usually one per core.
+ *
+ * Returns: the process exit status.
+ */
+int santa_coro_simulate(const int num_elves,
+                        const int herd_size,
+                        const int elves_per_group,
+                        const unsigned int seed,
+                        const int num_executors) {
+    coro_santa_t santa_coro;
+    coro_elf_t *elves;
+    coro_reindeer_t *herd;
+    clock_t start;
+    double elapsed;
+    int i;
+
+    assert(0 < elves_per_group);
+    assert(CORO_MAX_GROUP_SIZE >= elves_per_group);
+    assert(elves_per_group <= num_elves);
+    assert(0 < herd_size);
+    assert(0 < num_executors);
+
+    elves = (coro_elf_t *) calloc((size_t) num_elves, sizeof(coro_elf_t));
+    herd = (coro_reindeer_t *) calloc(
+        (size_t) herd_size, sizeof(coro_reindeer_t)
+    );
+    if(NULL == elves || NULL == herd) {
+        perror("santa_coro_simulate[calloc]");
+        exit(EXIT_FAILURE);
+    }
+
+    num_reindeer = herd_size;
+    group_size = elves_per_group;
+    verbose = (num_elves + num_reindeer) <= MAX_VERBOSE_ACTORS;
+
+    coro_sem_init(&santa_busy_mutex, 1);
+    coro_sem_init(&santa_sleep_mutex, 0); /* starts as locked! */
+    coro_sem_init(&reindeer_counting_sem, 0);
+    coro_sem_init(&elf_counting_sem, group_size);
+    coro_group_init(&elves_waiting, group_size, &santa_sleep_mutex);
+    coro_barrier_init(&hitching, num_reindeer);
+
+    /* santa gets the first executor, everyone else is spread out. */
+    coro_start(&(santa_coro.coro), &santa, 0);
+    for(i = 0; i < num_elves; ++i) {
+        elves[i].id = i;
+        elves[i].seed = seed + (unsigned int) i;
+        coro_start(&(elves[i].coro), &elf, i % num_executors);
+    }
+    for(i = 0; i < num_reindeer; ++i) {
+        herd[i].id = i;
+        herd[i].seed = ~seed + (unsigned int) i;
+        coro_start(&(herd[i].coro), &reindeer, i % num_executors);
+    }
+
+    start = clock();
+    coro_run(num_executors);
+    elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    fprintf(stdout,
+        "\n%d elves and %d reindeer on %d executors (%lu bytes of actors)\n"
+        "%lu elf groups helped, %lu resumes in %.3fs of cpu time\n",
+        num_elves, num_reindeer, num_executors,
+        (unsigned long) (num_elves * sizeof(coro_elf_t)
+                       + num_reindeer * sizeof(coro_reindeer_t)),
+        num_groups_helped, coro_num_resumes(), elapsed
+    );
+
+    free(elves);
+    free(herd);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+/*
+ * santa_coro.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef SANTA_CORO_H_
+#define SANTA_CORO_H_
+
+/* most elves that santa helps at once. */
+#define CORO_MAX_GROUP_SIZE 16
+
+int santa_coro_simulate(const int num_elves,
+                        const int herd_size,
+                        const int elves_per_group,
+                        const unsigned int seed,
+                        const int num_executors);
+
+#endif /* SANTA_CORO_H_ */
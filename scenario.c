@@ -0,0 +1,308 @@
+/*
+ * scenario.c
+ *
+ *     Version: $Id$
+ *
+ * Library for reading scenario files, which describe an experiment so that it
+ * can be re-run without editing any #defines. A scenario file is a list of
+ * "key = value" lines; everything after a '#' is a comment and blank lines
+ * are ignored. For example:
+ *
+ *      # four regions of heavily loaded elves
+ *      elves = 48
+ *      regions = 4
+ *      wait_delay = exponential
+ *      workload = membw
+ *      metrics = throughput latency
+ *
+ * This library knows nothing about what the keys mean; the program asks for
+ * each key it understands, giving the value to use if the key is missing, and
+ * then calls scenario_check so that a misspelled key is an error instead of
+ * being silently ignored.
+ *
+ * The scenario's hash covers the exact bytes of the file, so two results
+ * files with the same hash came from the same scenario.
+ */
+
+#include <string.h>
+#include <ctype.h>
+
+#include "scenario.h"
+
+/* revision of the source tree, filled in by the Makefile. */
+#ifndef BUILD_REVISION
+#define BUILD_REVISION "unknown"
+#endif
+
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME 16777619UL
+
+/**
+ * Remove leading and trailing whitespace from a string, in place.
+ */
+static char *trim(char *str) {
+    char *end;
+    while(isspace((unsigned char) *str)) {
+        ++str;
+    }
+    end = str + strlen(str);
+    while(end > str && isspace((unsigned char) end[-1])) {
+        --end;
+    }
+    *end = '\0';
+    return str;
+}
+
+/**
+ * Report a problem with a line of a scenario file and exit.
+ */
+static void scenario_error(scenario_t *scenario,
+                           const int line,
+                           const char *message,
+                           const char *detail) {
+    fprintf(stderr, "%s:%d: %s%s\n", scenario->path, line, message, detail);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Find an entry by its key, marking it as used.
+ */
+static scenario_entry_t *scenario_find(scenario_t *scenario, const char *key) {
+    int i;
+
+    assert(NULL != scenario);
+    assert(NULL != key);
+
+    for(i = 0; i < scenario->num_entries; ++i) {
+        if(!strcmp(key, scenario->entries[i].key)) {
+            scenario->entries[i].used = 1;
+            return &(scenario->entries[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Initialize an empty scenario, i.e. one where every key takes its default.
+ */
+void scenario_init(scenario_t *scenario) {
+    assert(NULL != scenario);
+    scenario->path = NULL;
+    scenario->hash = FNV_OFFSET_BASIS;
+    scenario->num_entries = 0;
+}
+
+/**
+ * Read in a scenario file. A key given more than once takes its last value.
+ *
+ * Side-Effects: If the file can't be read or is malformed then the program
+ *               will be exited.
+ */
+void scenario_load(scenario_t *scenario, const char *path) {
+    char line[SCENARIO_MAX_KEY_LENGTH + SCENARIO_MAX_VALUE_LENGTH + 8];
+    scenario_entry_t *entry;
+    char *key;
+    char *value;
+    char *ch;
+    FILE *in;
+    int line_num = 0;
+
+    assert(NULL != path);
+
+    scenario_init(scenario);
+    scenario->path = path;
+
+    in = fopen(path, "r");
+    if(NULL == in) {
+        perror("scenario_load[fopen]");
+        exit(EXIT_FAILURE);
+    }
+
+    while(NULL != fgets(line, (int) sizeof line, in)) {
+        ++line_num;
+
+        for(ch = line; '\0' != *ch; ++ch) {
+            scenario->hash = (scenario->hash ^ (unsigned char) *ch) * FNV_PRIME;
+            scenario->hash &= 0xffffffffUL;
+        }
+
+        if(NULL == strchr(line, '\n') && !feof(in)) {
+            scenario_error(scenario, line_num, "line is too long", "");
+        }
+
+        ch = strchr(line, '#');
+        if(NULL != ch) {
+            *ch = '\0';
+        }
+
+        key = trim(line);
+        if('\0' == *key) {
+            continue;
+        }
+
+        value = strchr(key, '=');
+        if(NULL == value) {
+            scenario_error(scenario, line_num, "expected key = value", "");
+        }
+        *value = '\0';
+        key = trim(key);
+        value = trim(value + 1);
+
+        if('\0' == *key || SCENARIO_MAX_KEY_LENGTH <= strlen(key)) {
+            scenario_error(scenario, line_num, "bad key: ", key);
+        } else if(SCENARIO_MAX_VALUE_LENGTH <= strlen(value)) {
+            scenario_error(scenario, line_num, "value is too long", "");
+        }
+
+        entry = scenario_find(scenario, key);
+        if(NULL == entry) {
+            if(SCENARIO_MAX_ENTRIES <= scenario->num_entries) {
+                scenario_error(scenario, line_num, "too many keys", "");
+            }
+            entry = &(scenario->entries[scenario->num_entries++]);
+            strcpy(entry->key, key);
+        }
+        strcpy(entry->value, value);
+        entry->line = line_num;
+        entry->used = 0;
+    }
+
+    fclose(in);
+}
+
+/**
+ * Get the integer value of a key, or some value if the key isn't given.
+ */
+int scenario_int(scenario_t *scenario, const char *key, const int value) {
+    scenario_entry_t *entry = scenario_find(scenario, key);
+    char *end;
+    long result;
+
+    if(NULL == entry) {
+        return value;
+    }
+
+    result = strtol(entry->value, &end, 10);
+    if('\0' == entry->value[0] || '\0' != *end) {
+        scenario_error(scenario, entry->line,
+            "expected an integer: ", entry->value
+        );
+    }
+    return (int) result;
+}
+
+/**
+ * Get the string value of a key, or some value if the key isn't given. The
+ * returned string lives as long as the scenario.
+ */
+const char *scenario_string(scenario_t *scenario,
+                            const char *key,
+                            const char *value) {
+    scenario_entry_t *entry = scenario_find(scenario, key);
+    return NULL == entry ? value : entry->value;
+}
+
+/**
+ * Get the value of a key that must be one of a NULL-terminated list of
+ * choices.
+ *
+ * Returns: the index of the chosen value, or some value if the key isn't
+ *          given.
+ */
+int scenario_choice(scenario_t *scenario,
+                    const char *key,
+                    const char **choices,
+                    const int value) {
+    scenario_entry_t *entry = scenario_find(scenario, key);
+    int i;
+
+    if(NULL == entry) {
+        return value;
+    }
+
+    for(i = 0; NULL != choices[i]; ++i) {
+        if(!strcmp(entry->value, choices[i])) {
+            return i;
+        }
+    }
+
+    scenario_error(scenario, entry->line, "unknown choice: ", entry->value);
+    return value;
+}
+
+/**
+ * Get the value of a key that is a space-separated list of names drawn from
+ * a NULL-terminated list.
+ *
+ * Returns: a bit mask with bit i set if the ith name is in the list, or some
+ *          flags if the key isn't given.
+ */
+int scenario_flags(scenario_t *scenario,
+                   const char *key,
+                   const char **names,
+                   const int flags) {
+    scenario_entry_t *entry = scenario_find(scenario, key);
+    char copy[SCENARIO_MAX_VALUE_LENGTH];
+    char *name;
+    int result = 0;
+    int i;
+
+    if(NULL == entry) {
+        return flags;
+    }
+
+    strcpy(copy, entry->value);
+    for(name = strtok(copy, " \t,"); NULL != name; name = strtok(NULL, " \t,")) {
+        for(i = 0; NULL != names[i]; ++i) {
+            if(!strcmp(name, names[i])) {
+                result |= 1 << i;
+                break;
+            }
+        }
+        if(NULL == names[i]) {
+            scenario_error(scenario, entry->line, "unknown name: ", name);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Make sure that every key in the scenario was asked for.
+ *
+ * Side-Effects: If any key wasn't used then the program will be exited.
+ */
+void scenario_check(scenario_t *scenario) {
+    int i;
+
+    assert(NULL != scenario);
+
+    for(i = 0; i < scenario->num_entries; ++i) {
+        if(!scenario->entries[i].used) {
+            scenario_error(scenario, scenario->entries[i].line,
+                "unknown key: ", scenario->entries[i].key
+            );
+        }
+    }
+}
+
+/**
+ * Write out where a scenario came from and what it was built with, as
+ * "key = value" lines.
+ */
+void scenario_describe(scenario_t *scenario, FILE *out) {
+    assert(NULL != scenario);
+
+    fprintf(out,
+        "scenario.path = %s\n"
+        "scenario.hash = %08lx\n"
+        "build.revision = %s\n"
+        "build.date = %s %s\n"
+        "build.compiler = gcc %s\n",
+        NULL == scenario->path ? "-" : scenario->path,
+        scenario->hash,
+        BUILD_REVISION,
+        __DATE__, __TIME__,
+        __VERSION__
+    );
+}
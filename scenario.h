@@ -0,0 +1,50 @@
+/*
+ * scenario.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef SCENARIO_H_
+#define SCENARIO_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+#define SCENARIO_MAX_ENTRIES 64
+#define SCENARIO_MAX_KEY_LENGTH 32
+#define SCENARIO_MAX_VALUE_LENGTH 128
+
+typedef struct {
+    char key[SCENARIO_MAX_KEY_LENGTH];
+    char value[SCENARIO_MAX_VALUE_LENGTH];
+    int line;
+    int used;
+} scenario_entry_t;
+
+typedef struct {
+    const char *path;
+    unsigned long hash;
+    int num_entries;
+    scenario_entry_t entries[SCENARIO_MAX_ENTRIES];
+} scenario_t;
+
+void scenario_init(scenario_t *scenario);
+void scenario_load(scenario_t *scenario, const char *path);
+int scenario_int(scenario_t *scenario, const char *key, const int value);
+const char *scenario_string(scenario_t *scenario,
+                            const char *key,
+                            const char *value);
+int scenario_choice(scenario_t *scenario,
+                    const char *key,
+                    const char **choices,
+                    const int value);
+int scenario_flags(scenario_t *scenario,
+                   const char *key,
+                   const char **names,
+                   const int flags);
+void scenario_check(scenario_t *scenario);
+void scenario_describe(scenario_t *scenario, FILE *out);
+
+#endif /* SCENARIO_H_ */
@@ -13,7 +13,17 @@
  * working with them.
  */
 
+#include <errno.h>
+#include <unistd.h>
+
 #include "sem.h"
+#include "clock.h"
+
+/* where to record how long each wait takes, if anywhere. */
+static hist_recorder_t *wait_times = NULL;
+
+/* set once any set has been emptied, i.e. once the program is tearing down. */
+static int is_emptying = 0;
 
 /**
  * Types of arguments for semop and semctl.
@@ -26,6 +36,25 @@ typedef union {
 
 typedef struct sembuf my_sembuf_t;
 
+/**
+ * Deal with a semop that failed. If the set was removed because the program
+ * is exiting and emptied it in an at-exit handler, then just wait to be torn
+ * down along with everything else rather than report an error and race the
+ * exit. Any other failure, including a bad set before teardown, is an error.
+ *
+ * Side-Effects: The program will be exited, or this never returns.
+ */
+static void semop_failed(const char *message) {
+    if((EIDRM == errno || EINVAL == errno)
+    && __atomic_load_n(&is_emptying, __ATOMIC_ACQUIRE)) {
+        for(;;) {
+            pause();
+        }
+    }
+    perror(message);
+    exit(EXIT_FAILURE);
+}
+
 /**
  * Fill a semaphore set. Prints an error if
  *
@@ -67,13 +96,16 @@ void sem_empty_set(sem_set_t *set) {
     my_semun_t _;
     assert(NULL != set);
 
+    __atomic_store_n(&is_emptying, 1, __ATOMIC_RELEASE);
     if(-1 == semctl(set->id, 0, IPC_RMID, _)) {
         perror("sem_empty_set[semctl]");
         exit(EXIT_FAILURE);
     }
 
+    /* num_semaphores is left alone as other threads may still be checking
+     * their indexes against it on their way to finding out that the set is
+     * gone. */
     set->id = -1;
-    set->num_semaphores = -1;
 }
 
 /**
@@ -172,6 +204,35 @@ void sem_init_all(sem_set_t *set, const int value) {
     }
 }
 
+/**
+ * Read the values of every semaphore in a set. This is meant for debugging
+ * output, so unlike everything else here, failing isn't fatal.
+ *
+ * Params: - Pointer to the semaphore set.
+ *         - Array of at least as many values as the set has semaphores.
+ *
+ * Returns: 0 if the values were read, -1 otherwise, e.g. if the set has been
+ *          removed.
+ */
+int sem_get_all(sem_set_t *set, unsigned short *values) {
+    my_semun_t arg;
+    assert(NULL != set);
+    assert(NULL != values);
+
+    arg.array = values;
+    return semctl(set->id, 0, GETALL, arg);
+}
+
+/**
+ * Record how long every wait on any semaphore takes from now on, including
+ * the waits for the lock of a critical section, in clock ticks.
+ *
+ * Params: - The recorder to record into, or NULL to stop recording.
+ */
+void sem_record_waits(hist_recorder_t *recorder) {
+    wait_times = recorder;
+}
+
 /**
  * Wait until a given semaphore has cleared.
  *
@@ -182,6 +243,7 @@ void sem_init_all(sem_set_t *set, const int value) {
  */
 void sem_wait_index(sem_set_t *set, const int sem_index) {
     my_sembuf_t op;
+    unsigned long start_ticks = 0;
 
     assert(NULL != set);
     assert(0 <= sem_index && sem_index < set->num_semaphores);
@@ -190,10 +252,50 @@ void sem_wait_index(sem_set_t *set, const int sem_index) {
     op.sem_flg = 0;
     op.sem_op = -1;
 
-    if(-1 == semop(set->id, &op, 1)) {
-        perror("sem_wait_index[semop]");
-        exit(EXIT_FAILURE);
+    if(NULL != wait_times) {
+        start_ticks = clock_ticks();
+    }
+
+    /* semop is never restarted after a signal handler runs, such as the
+     * profiler's, so it's retried here and below. */
+    while(-1 == semop(set->id, &op, 1)) {
+        if(EINTR != errno) {
+            semop_failed("sem_wait_index[semop]");
+        }
+    }
+    if(NULL != wait_times) {
+        hist_record(wait_times, clock_ticks() - start_ticks);
+    }
+}
+
+/**
+ * Take a given semaphore if it can be taken without waiting.
+ *
+ * Params: - Pointer to semaphore set to which the indexed semaphore belongs.
+ *         - Index of semaphore to take.
+ *
+ * Returns: 1 if the semaphore was taken, 0 if it would have had to wait.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+int sem_try_wait_index(sem_set_t *set, const int sem_index) {
+    my_sembuf_t op;
+
+    assert(NULL != set);
+    assert(0 <= sem_index && sem_index < set->num_semaphores);
+
+    op.sem_num = sem_index;
+    op.sem_flg = IPC_NOWAIT;
+    op.sem_op = -1;
+
+    while(-1 == semop(set->id, &op, 1)) {
+        if(EAGAIN == errno) {
+            return 0;
+        } else if(EINTR != errno) {
+            semop_failed("sem_try_wait_index[semop]");
+        }
     }
+    return 1;
 }
 
 /**
@@ -219,8 +321,39 @@ void sem_signal_index(sem_set_t *set,
     op.sem_flg = 0;
     op.sem_op = num_signals;
 
-    if(-1 == semop(set->id, &op, 1)) {
-        perror("sem_init[semop]");
-        exit(EXIT_FAILURE);
+    while(-1 == semop(set->id, &op, 1)) {
+        if(EINTR != errno) {
+            semop_failed("sem_signal_index[semop]");
+        }
+    }
+}
+
+/**
+ * Read a semaphore's value and how many threads are waiting on it. Like
+ * sem_get_all, this is for watching the semaphores from the outside, so
+ * failing isn't fatal.
+ *
+ * Params: - Pointer to semaphore set to which the indexed semaphore belongs.
+ *         - Index of the semaphore to read.
+ *         - Where to put the counts.
+ *
+ * Returns: 0 if the counts were read, -1 otherwise.
+ */
+int sem_get_counts(sem_set_t *set, const int sem_index, sem_counts_t *counts) {
+    my_semun_t _;
+
+    assert(NULL != set);
+    assert(NULL != counts);
+    assert(0 <= sem_index && sem_index < set->num_semaphores);
+
+    counts->value = semctl(set->id, sem_index, GETVAL, _);
+    counts->num_waiting = semctl(set->id, sem_index, GETNCNT, _);
+    counts->num_waiting_for_zero = semctl(set->id, sem_index, GETZCNT, _);
+
+    if(-1 == counts->value
+    || -1 == counts->num_waiting
+    || -1 == counts->num_waiting_for_zero) {
+        return -1;
     }
+    return 0;
 }
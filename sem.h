@@ -18,6 +18,7 @@
 #include <alloca.h>
 
 #include "assert.h"
+#include "hist.h"
 
 /* Represents a set of UNIX semaphores. */
 typedef struct {
@@ -31,23 +32,37 @@ typedef struct {
     int num;
 } sem_t;
 
+/* What the kernel knows about a semaphore: its value, how many threads are
+ * waiting for it to be signalled, and how many are waiting for it to be 0. */
+typedef struct {
+    int value;
+    int num_waiting;
+    int num_waiting_for_zero;
+} sem_counts_t;
+
 /* operations on sets of semaphores */
 void sem_fill_set(sem_set_t *set, const int num_semaphores);
 void sem_empty_set(sem_set_t *set);
 void sem_unpack_set(sem_set_t *set, sem_t *sem1, ...);
 void sem_init_all(sem_set_t *set, const int value);
+int sem_get_all(sem_set_t *set, unsigned short *values);
+void sem_record_waits(hist_recorder_t *recorder);
 
 /* operations on individual semaphores */
 void sem_init_index(sem_set_t *set, const int sem_index, const int value);
 void sem_wait_index(sem_set_t *set, const int sem_index);
+int sem_try_wait_index(sem_set_t *set, const int sem_index);
 void sem_signal_index(sem_set_t *set,
                       const int sem_index,
                       const int num_signals);
+int sem_get_counts(sem_set_t *set, const int sem_index, sem_counts_t *counts);
 
 #define sem_init(sem, val) sem_init_index((sem).set, (sem).num, (val))
 #define sem_wait(sem) sem_wait_index((sem).set, (sem).num)
+#define sem_try_wait(sem) sem_try_wait_index((sem).set, (sem).num)
 #define sem_signal(sem) sem_signal_index((sem).set, (sem).num, 1)
 #define sem_signal_ntimes(sem, n) sem_signal_index((sem).set, (sem).num, (n))
+#define sem_counts(sem, counts) sem_get_counts((sem).set, (sem).num, (counts))
 
 #define CRITICAL(sem, context) {sem_wait(sem);{context}sem_signal(sem);}
 
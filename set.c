@@ -9,9 +9,21 @@
  * nice data structure as a given item will only ever go into a specific slot
  * in the set. An item can be put in as many times without changing the state
  * of the set. Thus, two threads won't ever clobber the state of the set.
+ *
+ * Readers that only want to look, such as stats and debug output, never take
+ * the lock. The set keeps a sequence number that a writer makes odd while it
+ * changes the slots and even again once it's done, so a reader copies the
+ * slots out and tries again if the sequence was odd or changed while it was
+ * copying. Readers never write to the set, so watching it adds no contention
+ * to set_insert and set_take; each of those only adds two stores.
  */
 
 #include "set.h"
+#include "alloc.h"
+#include "clock.h"
+
+/* where to record how long the write lock is held for, if anywhere. */
+static hist_recorder_t *hold_times = NULL;
 
 /**
  * This is equivalent to a bitset; however, I was a bit lazy, so I just made it
@@ -24,6 +36,9 @@ struct set {
 
     int num_slots;
     int cardinality;
+
+    /* odd while the slots are being changed; only written with the lock. */
+    unsigned int sequence;
 };
 
 /**
@@ -46,10 +61,12 @@ set_t set_alloc(const int num_slots) {
     if(NULL == set) {
         return NULL;
     }
+    alloc_account("sets", obj_size + buff_size);
 
     set->slots = ((char *) set) + obj_size;
     set->cardinality = 0;
     set->num_slots = num_slots;
+    set->sequence = 0;
 
 
     memset(&(set->slots[0]), 0, buff_size);
@@ -82,22 +99,55 @@ void set_free(set_t set) {
     free(set);
 }
 
+/**
+ * Start changing the set; the caller must hold the write lock.
+ */
+static void write_begin(set_t set) {
+    __atomic_store_n(&(set->sequence), set->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Finish changing the set.
+ */
+static void write_end(set_t set) {
+    __atomic_store_n(&(set->sequence), set->sequence + 1, __ATOMIC_RELEASE);
+}
+
 /**
  * Add an item (integer) into the set.
  *
  * Params: - Pointer to the set to add an item to.
  */
 void set_insert(set_t set, const int item) {
+    unsigned long held_ticks = 0;
+
     assert(NULL != set);
     assert(item >= 0 && item < set->num_slots);
 
     CRITICAL(set->write_lock, {
+        if(NULL != hold_times) {
+            held_ticks = clock_ticks();
+        }
+
         /* add the item into the set */
-        set->slots[item] = 1;
+        write_begin(set);
+        __atomic_store_n(&(set->slots[item]), 1, __ATOMIC_RELAXED);
         if(set->cardinality < set->num_slots) {
-            ++(set->cardinality);
+            __atomic_store_n(
+                &(set->cardinality), set->cardinality + 1, __ATOMIC_RELAXED
+            );
+        }
+        write_end(set);
+
+        if(NULL != hold_times) {
+            held_ticks = clock_ticks() - held_ticks;
         }
     });
+
+    if(NULL != hold_times) {
+        hist_record(hold_times, held_ticks);
+    }
 }
 
 /**
@@ -106,27 +156,136 @@ void set_insert(set_t set, const int item) {
  * Params: - Pointer to the set to remove an item from.
  */
 int set_take(set_t set) {
+    unsigned long held_ticks = 0;
     int item;
     assert(NULL != set);
 
     CRITICAL(set->write_lock, {
+        if(NULL != hold_times) {
+            held_ticks = clock_ticks();
+        }
+
         /* find a random item in the set */
         for(item = rand() % set->num_slots;
             !set->slots[item];
             item = rand() % set->num_slots);
 
-        set->slots[item] = 0;
-        --(set->cardinality);
+        write_begin(set);
+        __atomic_store_n(&(set->slots[item]), 0, __ATOMIC_RELAXED);
+        __atomic_store_n(
+            &(set->cardinality), set->cardinality - 1, __ATOMIC_RELAXED
+        );
+        write_end(set);
+
+        if(NULL != hold_times) {
+            held_ticks = clock_ticks() - held_ticks;
+        }
     });
 
+    if(NULL != hold_times) {
+        hist_record(hold_times, held_ticks);
+    }
     return item;
 }
 
+/**
+ * Record how long any set's write lock is held for from now on, in clock
+ * ticks. The time is recorded once the lock is released, so that recording
+ * doesn't add to the hold.
+ *
+ * Params: - The recorder to record into, or NULL to stop recording.
+ */
+void set_record_holds(hist_recorder_t *recorder) {
+    hold_times = recorder;
+}
+
 /**
  * Get the number of items currently in the set.
  *
  * Params: - Pointer to the set being queried.
  */
 int set_cardinality(const set_t set) {
-    return set->cardinality;
+    return __atomic_load_n(&(set->cardinality), __ATOMIC_RELAXED);
+}
+
+/**
+ * Copy the items in the set out into a bitset, without taking the write lock.
+ * The bits are of the items that were in the set at one moment, even if the
+ * set is being changed at the same time. Item i is bit i % SET_BITS_PER_WORD
+ * of word i / SET_BITS_PER_WORD.
+ *
+ * Params: - Pointer to the set being looked at.
+ *         - Where to put the bits; this must have at least
+ *           SET_WORDS(number of slots) words.
+ *
+ * Returns: the number of items in the set, or -1 if the set kept changing
+ *          for SET_SNAPSHOT_TRIES tries, in which case the bits are garbage.
+ */
+int set_snapshot_bits(const set_t set, unsigned long *words) {
+    unsigned int sequence;
+    int num_items;
+    int tries;
+    int i;
+
+    assert(NULL != set);
+    assert(NULL != words);
+
+    for(tries = 0; tries < SET_SNAPSHOT_TRIES; ++tries) {
+        sequence = __atomic_load_n(&(set->sequence), __ATOMIC_ACQUIRE);
+        if(sequence & 1) {
+            continue;
+        }
+
+        memset(words, 0, sizeof(unsigned long) * SET_WORDS(set->num_slots));
+        num_items = 0;
+        for(i = 0; i < set->num_slots; ++i) {
+            if(__atomic_load_n(&(set->slots[i]), __ATOMIC_RELAXED)) {
+                words[i / SET_BITS_PER_WORD] |=
+                    1UL << (i % SET_BITS_PER_WORD);
+                ++num_items;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(sequence == __atomic_load_n(&(set->sequence), __ATOMIC_RELAXED)) {
+            return num_items;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Print out the items in the set. This doesn't take the write lock, so that
+ * it can be used to see what's in a set while something is stuck holding the
+ * lock. If a writer is stuck in the middle of changing the set, then what
+ * the slots say is printed anyway, and marked as such.
+ *
+ * Params: - Pointer to the set being printed.
+ *         - Where to print it.
+ */
+void set_print(const set_t set, FILE *out) {
+    unsigned long *words;
+    int num_items;
+    int i;
+    assert(NULL != set);
+
+    words = (unsigned long *) alloca(
+        sizeof(unsigned long) * SET_WORDS(set->num_slots)
+    );
+    num_items = set_snapshot_bits(set, words);
+
+    fprintf(out, "{");
+    for(i = 0; i < set->num_slots; ++i) {
+        if(0 > num_items
+           ? __atomic_load_n(&(set->slots[i]), __ATOMIC_RELAXED)
+           : (words[i / SET_BITS_PER_WORD] >> (i % SET_BITS_PER_WORD)) & 1) {
+            fprintf(out, " %d", i);
+        }
+    }
+    if(0 > num_items) {
+        fprintf(out, " } (%d items, changing)", set_cardinality(set));
+    } else {
+        fprintf(out, " } (%d items)", num_items);
+    }
 }
@@ -10,11 +10,22 @@
 #define SET_H_
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "assert.h"
 #include "sem.h"
 
+/* how many times a snapshot tries to get a consistent copy of a set before
+ * giving up; a writer only holds the set for a few stores, so this is only
+ * ever reached when the writer is stuck. */
+#define SET_SNAPSHOT_TRIES 1000
+
+/* bitsets that snapshots are copied into. */
+#define SET_BITS_PER_WORD ((int) (8 * sizeof(unsigned long)))
+#define SET_WORDS(num_slots) \
+    (((num_slots) + SET_BITS_PER_WORD - 1) / SET_BITS_PER_WORD)
+
 typedef struct set *set_t;
 
 set_t set_alloc(const int num_slots);
@@ -23,5 +34,8 @@ void set_free(set_t set);
 void set_insert(set_t set, const int item);
 int set_take(set_t set);
 int set_cardinality(const set_t set);
+int set_snapshot_bits(const set_t set, unsigned long *words);
+void set_print(const set_t set, FILE *out);
+void set_record_holds(hist_recorder_t *recorder);
 
 #endif /* SET_H_ */
@@ -0,0 +1,178 @@
+/*
+ * state.c
+ *
+ *     Version: $Id$
+ *
+ * Library for keeping track of what a santa is doing in a single word, instead
+ * of using a semaphore as a flag that one thread locks and another unlocks.
+ * Every change is a compare-and-swap, so a transition either happens from the
+ * state that the caller expected or not at all, and anyone can wait on the
+ * word until it changes, which is a futex wait on the word itself.
+ *
+ * Whenever the state (but not just the count) changes, the thread that made
+ * the change charges the time since the last change to the old state. Two
+ * changes that race can charge a few nanoseconds to the wrong state, but no
+ * time is ever lost or counted twice.
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "clock.h"
+#include "state.h"
+
+const char *state_names[] = {
+    "sleeping", "helping", "preparing", "departed", NULL
+};
+
+/**
+ * Charge the time since the last change of state to the old state, and wake
+ * up anyone waiting on the word.
+ */
+static void changed(state_word_t *state, const int old, const int word) {
+    unsigned long now;
+    unsigned long entered;
+
+    if(STATE_OF(old) != STATE_OF(word)) {
+        now = clock_ns();
+        entered = __atomic_exchange_n(
+            &(state->entered_ns), now, __ATOMIC_RELAXED
+        );
+        __sync_fetch_and_add(
+            &(state->residency_ns[STATE_OF(old)]), now - entered
+        );
+        __sync_fetch_and_add(&(state->num_entries[STATE_OF(word)]), 1);
+    }
+
+    if(__atomic_load_n(&(state->num_waiters), __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &(state->word), FUTEX_WAKE_PRIVATE, INT_MAX,
+            NULL, NULL, 0
+        );
+    }
+}
+
+/**
+ * Initialize a state word.
+ */
+void state_init(state_word_t *state, const int word) {
+    int i;
+
+    assert(NULL != state);
+
+    state->word = word;
+    state->num_waiters = 0;
+    state->entered_ns = clock_ns();
+    for(i = 0; i < STATE_NUM_STATES; ++i) {
+        state->residency_ns[i] = 0;
+        state->num_entries[i] = 0;
+    }
+    state->num_entries[STATE_OF(word)] = 1;
+}
+
+/**
+ * Get the current word.
+ */
+int state_load(state_word_t *state) {
+    return __atomic_load_n(&(state->word), __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Change the word from one value to another, if it still has the first.
+ *
+ * Returns: 1 if the word was changed, 0 otherwise.
+ */
+int state_cas(state_word_t *state, const int expected, const int desired) {
+    int old = expected;
+
+    if(!__atomic_compare_exchange_n(&(state->word), &old, desired, 0,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    changed(state, expected, desired);
+    return 1;
+}
+
+/**
+ * Change the word no matter what it was; for states that are never left,
+ * such as STATE_DEPARTED.
+ */
+void state_store(state_word_t *state, const int word) {
+    changed(state, __atomic_exchange_n(&(state->word), word, __ATOMIC_SEQ_CST),
+        word
+    );
+}
+
+/**
+ * Wait until the word is no longer some value.
+ *
+ * Returns: the new word.
+ */
+int state_wait_change(state_word_t *state, const int word) {
+    int current;
+
+    __sync_fetch_and_add(&(state->num_waiters), 1);
+    while(word == (current = state_load(state))) {
+        syscall(SYS_futex, &(state->word), FUTEX_WAIT_PRIVATE, word,
+            NULL, NULL, 0
+        );
+    }
+    __sync_fetch_and_sub(&(state->num_waiters), 1);
+
+    return current;
+}
+
+/**
+ * Wait until the word is in some state.
+ *
+ * Returns: the word, as of when it was seen to be in that state.
+ */
+int state_wait_for(state_word_t *state, const state_t wanted) {
+    int word = state_load(state);
+    while(wanted != STATE_OF(word)) {
+        word = state_wait_change(state, word);
+    }
+    return word;
+}
+
+/**
+ * Wait until the word is in some state, and then change it before anyone
+ * else can; this is how a thread takes ownership of a santa.
+ */
+void state_acquire(state_word_t *state, const state_t from, const int desired) {
+    int word;
+    do {
+        word = state_wait_for(state, from);
+    } while(!state_cas(state, word, desired));
+}
+
+/**
+ * Print out what share of the time since the word was initialized it spent in
+ * each state, and how many times it went into each.
+ */
+void state_report(state_word_t *state, const char *name, FILE *out) {
+    unsigned long residency_ns[STATE_NUM_STATES];
+    unsigned long total_ns = 0;
+    int i;
+
+    for(i = 0; i < STATE_NUM_STATES; ++i) {
+        residency_ns[i] = state->residency_ns[i];
+    }
+    residency_ns[STATE_OF(state_load(state))] += clock_ns() - state->entered_ns;
+    for(i = 0; i < STATE_NUM_STATES; ++i) {
+        total_ns += residency_ns[i];
+    }
+
+    fprintf(out, "    %-10s", name);
+    for(i = 0; i < STATE_NUM_STATES; ++i) {
+        fprintf(out, " %s %5.1f%% (%lu)",
+            state_names[i],
+            100.0 * residency_ns[i] / (total_ns ? total_ns : 1),
+            state->num_entries[i]
+        );
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,52 @@
+/*
+ * state.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef STATE_H_
+#define STATE_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+/* a state word holds the state in its low STATE_BITS bits, and a count, such
+ * as the number of elves being helped, above them. */
+#define STATE_BITS 8
+#define STATE_MASK ((1 << STATE_BITS) - 1)
+#define STATE_WORD(state, count) (((count) << STATE_BITS) | (int) (state))
+#define STATE_OF(word) ((state_t) ((word) & STATE_MASK))
+#define STATE_COUNT(word) ((word) >> STATE_BITS)
+
+typedef enum {
+    STATE_SLEEPING,
+    STATE_HELPING,
+    STATE_PREPARING,
+    STATE_DEPARTED,
+    STATE_NUM_STATES
+} state_t;
+
+/* What a santa is doing, as one word that changes by compare-and-swap, along
+ * with how long the word has spent in each state. */
+typedef struct {
+    int word;
+    int num_waiters;
+    unsigned long entered_ns;
+    unsigned long residency_ns[STATE_NUM_STATES];
+    unsigned long num_entries[STATE_NUM_STATES];
+} state_word_t;
+
+extern const char *state_names[];
+
+void state_init(state_word_t *state, const int word);
+int state_load(state_word_t *state);
+int state_cas(state_word_t *state, const int expected, const int desired);
+void state_store(state_word_t *state, const int word);
+int state_wait_change(state_word_t *state, const int word);
+int state_wait_for(state_word_t *state, const state_t wanted);
+void state_acquire(state_word_t *state, const state_t from, const int desired);
+void state_report(state_word_t *state, const char *name, FILE *out);
+
+#endif /* STATE_H_ */
@@ -0,0 +1,158 @@
+/*
+ * trace.c
+ *
+ *     Version: $Id$
+ *
+ * Library for keeping the most recent events of a simulation in a ring buffer
+ * that lives in a memory-mapped file. Nothing is ever written out explicitly;
+ * the kernel owns the pages, so whatever was recorded survives the process
+ * being killed or exiting from an assert. tracedump reads the file back. The
+ * trace is never unmapped, as threads may still be recording events while the
+ * process exits.
+ *
+ * Each thread is given its own lane the first time that it records an event,
+ * which keeps threads from contending over the same head. If there are more
+ * threads than lanes then lanes are shared, which is still safe as slots are
+ * claimed with an atomic increment of the head.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "clock.h"
+#include "trace.h"
+#include "alloc.h"
+
+static trace_header_t *trace = NULL;
+static trace_record_t *records = NULL;
+static size_t trace_size = 0;
+static int next_lane = 0;
+static __thread int lane = -1;
+
+static const char *actor_names[] = {
+    "santa", "elf", "reindeer"
+};
+
+static const char *event_names[] = {
+    "sleeping", "woken", "helping-elf", "preparing-sleigh", "working",
+    "needs-help", "in-line", "got-help", "vacation", "back", "hitched",
+    "departed", "hired", "retired"
+};
+
+/**
+ * Create a trace file and map it into memory. Any existing file is replaced.
+ *
+ * Params: - Path to the trace file.
+ *         - Number of lanes, at most TRACE_MAX_LANES.
+ *         - Number of events kept per lane.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void trace_open(const char *path,
+                const int num_lanes,
+                const int events_per_lane) {
+    int fd;
+
+    assert(NULL != path);
+    assert(NULL == trace);
+    assert(0 < num_lanes && num_lanes <= TRACE_MAX_LANES);
+    assert(0 < events_per_lane);
+
+    trace_size = sizeof(trace_header_t)
+               + sizeof(trace_record_t) * num_lanes * events_per_lane;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(-1 == fd) {
+        perror("trace_open[open]");
+        exit(EXIT_FAILURE);
+    }
+
+    if(-1 == ftruncate(fd, (off_t) trace_size)) {
+        perror("trace_open[ftruncate]");
+        exit(EXIT_FAILURE);
+    }
+
+    trace = (trace_header_t *) mmap(
+        NULL, trace_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    if(MAP_FAILED == (void *) trace) {
+        perror("trace_open[mmap]");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    alloc_account("trace ring", trace_size);
+
+    records = (trace_record_t *) (trace + 1);
+    trace->version = TRACE_VERSION;
+    trace->num_lanes = num_lanes;
+    trace->events_per_lane = events_per_lane;
+    trace->record_size = (int) sizeof(trace_record_t);
+    trace->start_ns = clock_ns();
+
+    /* the magic goes in last so that a half-made file isn't trusted. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&(trace->magic[0]), TRACE_MAGIC, sizeof(trace->magic));
+}
+
+/**
+ * Record an event. This is a no-op if no trace is open.
+ *
+ * Params: - The kind of actor recording the event.
+ *         - The actor's id.
+ *         - What happened.
+ *         - Some event-specific argument.
+ */
+void trace_event(const trace_actor_t actor,
+                 const int actor_id,
+                 const trace_event_t event,
+                 const int arg) {
+    trace_record_t *record;
+    unsigned long seq;
+
+    if(NULL == trace) {
+        return;
+    }
+
+    if(0 > lane) {
+        lane = __sync_fetch_and_add(&next_lane, 1) % trace->num_lanes;
+    }
+
+    seq = __atomic_fetch_add(
+        &(trace->lanes[lane].head), 1UL, __ATOMIC_RELAXED
+    );
+    record = &(records[lane * trace->events_per_lane
+                     + (int) (seq % (unsigned long) trace->events_per_lane)]);
+
+    record->time_ns = clock_ns();
+    record->actor = actor;
+    record->actor_id = actor_id;
+    record->event = event;
+    record->arg = arg;
+
+    /* sequence numbers start at 1 so that an empty slot is never valid. */
+    __atomic_store_n(&(record->seq), seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get the name of a kind of actor.
+ */
+const char *trace_actor_name(const int actor) {
+    if(0 > actor || actor >= TRACE_NUM_ACTORS) {
+        return "?";
+    }
+    return actor_names[actor];
+}
+
+/**
+ * Get the name of an event.
+ */
+const char *trace_event_name(const int event) {
+    if(0 > event || event >= TRACE_NUM_EVENTS) {
+        return "?";
+    }
+    return event_names[event];
+}
@@ -0,0 +1,90 @@
+/*
+ * trace.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+#define TRACE_MAGIC "SANTATRC"
+#define TRACE_VERSION 1
+#define TRACE_MAX_LANES 256
+#define TRACE_CACHE_LINE 64
+
+/* default size of a trace: 16 lanes of 64K events, i.e. the last million
+ * events or so. */
+#define TRACE_DEFAULT_LANES 16
+#define TRACE_DEFAULT_EVENTS_PER_LANE (1 << 16)
+
+/* who did something */
+typedef enum {
+    TRACE_SANTA,
+    TRACE_ELF,
+    TRACE_REINDEER,
+    TRACE_NUM_ACTORS
+} trace_actor_t;
+
+/* what they did */
+typedef enum {
+    TRACE_SLEEPING,
+    TRACE_WOKEN,
+    TRACE_HELPING_ELF,
+    TRACE_PREPARING_SLEIGH,
+    TRACE_WORKING,
+    TRACE_NEEDS_HELP,
+    TRACE_IN_LINE,
+    TRACE_GOT_HELP,
+    TRACE_VACATION,
+    TRACE_BACK,
+    TRACE_HITCHED,
+    TRACE_DEPARTED,
+    TRACE_HIRED,
+    TRACE_RETIRED,
+    TRACE_NUM_EVENTS
+} trace_event_t;
+
+/* A single event in a lane. The sequence number is written last; a reader
+ * only trusts an event whose sequence number matches its slot. */
+typedef struct {
+    unsigned long seq;
+    unsigned long time_ns;
+    int actor;
+    int actor_id;
+    int event;
+    int arg;
+} trace_record_t;
+
+/* Head of a lane, on its own cache line. head is the number of events ever
+ * written to the lane. */
+typedef struct {
+    unsigned long head;
+    char pad[TRACE_CACHE_LINE - sizeof(unsigned long)];
+} trace_lane_t;
+
+/* The start of a trace file; the lanes of events follow it. */
+typedef struct {
+    char magic[8];
+    int version;
+    int num_lanes;
+    int events_per_lane;
+    int record_size;
+    unsigned long start_ns;
+    trace_lane_t lanes[TRACE_MAX_LANES];
+} trace_header_t;
+
+void trace_open(const char *path, const int num_lanes, const int events_per_lane);
+void trace_event(const trace_actor_t actor,
+                 const int actor_id,
+                 const trace_event_t event,
+                 const int arg);
+
+const char *trace_actor_name(const int actor);
+const char *trace_event_name(const int event);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,145 @@
+/*
+ * tracedump.c
+ *
+ *     Version: $Id$
+ *
+ * Print out the events kept in a trace file written by trace.c, oldest first.
+ * This works whether or not the process that wrote the trace is still alive,
+ * which is the whole point: run it after a stall or a crash to see what the
+ * simulation was doing right before.
+ *
+ * Usage: tracedump <trace file> [number of most recent events to print]
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+/**
+ * Order records by the time at which they were recorded.
+ */
+static int compare_records(const void *a, const void *b) {
+    const trace_record_t *ra = (const trace_record_t *) a;
+    const trace_record_t *rb = (const trace_record_t *) b;
+    if(ra->time_ns != rb->time_ns) {
+        return ra->time_ns < rb->time_ns ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ * Map a trace file and make sure that it looks like a trace.
+ */
+static trace_header_t *map_trace(const char *path, size_t *size) {
+    struct stat info;
+    trace_header_t *trace;
+    int fd = open(path, O_RDONLY);
+
+    if(-1 == fd || -1 == fstat(fd, &info)) {
+        perror("map_trace[open]");
+        exit(EXIT_FAILURE);
+    }
+
+    *size = (size_t) info.st_size;
+    if(*size < sizeof(trace_header_t)) {
+        fprintf(stderr, "%s is too small to be a trace.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    trace = (trace_header_t *) mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    if(MAP_FAILED == (void *) trace) {
+        perror("map_trace[mmap]");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if(memcmp(&(trace->magic[0]), TRACE_MAGIC, sizeof(trace->magic))
+    || TRACE_VERSION != trace->version
+    || (int) sizeof(trace_record_t) != trace->record_size
+    || *size < sizeof(trace_header_t) + sizeof(trace_record_t)
+                * trace->num_lanes * trace->events_per_lane) {
+        fprintf(stderr, "%s is not a usable trace.\n", path);
+        exit(EXIT_FAILURE);
+    }
+
+    return trace;
+}
+
+/**
+ * Dump a trace.
+ */
+int main(int argc, char *argv[]) {
+    trace_header_t *trace;
+    trace_record_t *lanes;
+    trace_record_t *records;
+    trace_record_t *record;
+    unsigned long head;
+    unsigned long seq;
+    unsigned long first;
+    size_t size;
+    int num_records = 0;
+    int num_to_print;
+    int i;
+
+    if(2 > argc) {
+        fprintf(stderr, "Usage: %s <trace file> [num events]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    trace = map_trace(argv[1], &size);
+    lanes = (trace_record_t *) (trace + 1);
+
+    records = (trace_record_t *) malloc(
+        sizeof(trace_record_t) * trace->num_lanes * trace->events_per_lane
+    );
+    if(NULL == records) {
+        perror("main[malloc]");
+        return EXIT_FAILURE;
+    }
+
+    /* pull out every record that is still intact. */
+    for(i = 0; i < trace->num_lanes; ++i) {
+        head = trace->lanes[i].head;
+        first = head > (unsigned long) trace->events_per_lane
+              ? head - trace->events_per_lane
+              : 0;
+
+        for(seq = first; seq < head; ++seq) {
+            record = &(lanes[i * trace->events_per_lane
+                           + (int) (seq % trace->events_per_lane)]);
+            if(seq + 1 == record->seq) {
+                records[num_records++] = *record;
+            }
+        }
+    }
+
+    qsort(records, (size_t) num_records, sizeof(trace_record_t), &compare_records);
+
+    num_to_print = 2 < argc ? atoi(argv[2]) : num_records;
+    if(num_to_print > num_records) {
+        num_to_print = num_records;
+    }
+
+    fprintf(stdout, "# %d events kept in %d lanes, showing the last %d\n",
+        num_records, trace->num_lanes, num_to_print
+    );
+    for(i = num_records - num_to_print; i < num_records; ++i) {
+        fprintf(stdout, "%12.6f %-8s %6d %-16s %d\n",
+            (double) (records[i].time_ns - trace->start_ns) / 1e9,
+            trace_actor_name(records[i].actor),
+            records[i].actor_id,
+            trace_event_name(records[i].event),
+            records[i].arg
+        );
+    }
+
+    free(records);
+    munmap(trace, size);
+    return EXIT_SUCCESS;
+}
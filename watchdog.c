@@ -0,0 +1,177 @@
+/*
+ * watchdog.c
+ *
+ *     Version: $Id$
+ *
+ * Library for noticing when a simulation has stopped making progress, e.g.
+ * because someone is stuck in a semop after a lost signal. Each actor has a
+ * heartbeat slot that it bumps whenever it changes state; a watchdog thread
+ * looks at every slot each WATCHDOG_INTERVAL_NS, and if none of them have
+ * changed for long enough it calls a dump function to print out what everyone
+ * was doing. It dumps once per stall, and re-arms once progress resumes.
+ *
+ * A heartbeat packs a beat count and the actor's current state into one word
+ * that only its actor writes to, so beating is a read of the actor's own word
+ * and a single relaxed store; there are no atomic read-modify-writes and no
+ * fences on the actors' paths. Slots are padded out to their own cache lines
+ * so that actors don't bounce lines between each other.
+ */
+
+#define _GNU_SOURCE
+
+#include <time.h>
+#include <pthread.h>
+
+#include "clock.h"
+#include "watchdog.h"
+
+/* the low byte of a heartbeat holds the state plus one, so that a slot that
+ * has never beaten reads as zero. */
+#define STATE_BITS 8
+#define STATE_MASK ((1UL << STATE_BITS) - 1)
+
+typedef struct {
+    unsigned long word;
+    char padding[64 - sizeof(unsigned long)];
+} heartbeat_t;
+
+static heartbeat_t heartbeats[WATCHDOG_MAX_SLOTS];
+
+/* only touched by the watchdog thread, except for being read by the dump
+ * function through watchdog_state, which the watchdog thread calls. */
+static unsigned long last_words[WATCHDOG_MAX_SLOTS];
+static unsigned long last_change_ns[WATCHDOG_MAX_SLOTS];
+
+static int num_watched_slots = 0;
+static unsigned long stall_threshold_ns = 0;
+static watchdog_dump_t dump_stall = NULL;
+
+/**
+ * Record that an actor has moved to a new state.
+ *
+ * Params: - The actor's heartbeat slot; every slot must only ever be written
+ *           by one thread at a time.
+ *         - The actor's new state, from 0 to 254.
+ */
+void watchdog_beat(const int slot, const int state) {
+    heartbeat_t *heartbeat;
+    unsigned long word;
+
+    assert(0 <= slot && slot < WATCHDOG_MAX_SLOTS);
+    assert(0 <= state && (unsigned long) state < STATE_MASK);
+
+    heartbeat = &(heartbeats[slot]);
+    word = heartbeat->word;
+
+    __atomic_store_n(
+        &(heartbeat->word),
+        ((word | STATE_MASK) + 1) | (unsigned long) (state + 1),
+        __ATOMIC_RELAXED
+    );
+}
+
+/**
+ * Get what an actor was last doing, and for how long, as of the watchdog's
+ * most recent look at the heartbeats.
+ *
+ * Params: - The actor's heartbeat slot.
+ *         - Where to put the number of times the actor has beaten.
+ *         - Where to put how long it's been since the actor's last beat.
+ *
+ * Returns: the actor's state, or -1 if the actor has never beaten.
+ */
+int watchdog_state(const int slot,
+                   unsigned long *num_beats,
+                   unsigned long *idle_ns) {
+    unsigned long word;
+
+    assert(0 <= slot && slot < WATCHDOG_MAX_SLOTS);
+
+    word = last_words[slot];
+
+    *num_beats = word >> STATE_BITS;
+    *idle_ns = clock_ns() - last_change_ns[slot];
+    return (int) (word & STATE_MASK) - 1;
+}
+
+/**
+ * Look at all of the heartbeats every so often, and dump everything when
+ * none of them have changed for too long.
+ */
+static void *watchdog(void *_) {
+    struct timespec interval;
+    unsigned long last_progress_ns = clock_ns();
+    unsigned long now_ns;
+    unsigned long word;
+    int has_dumped = 0;
+    int made_progress;
+    int i;
+
+    interval.tv_sec = (time_t) (WATCHDOG_INTERVAL_NS / NS_PER_SEC);
+    interval.tv_nsec = (long) (WATCHDOG_INTERVAL_NS % NS_PER_SEC);
+
+    for(i = 0; i < num_watched_slots; ++i) {
+        last_change_ns[i] = last_progress_ns;
+    }
+
+    while(1) {
+        nanosleep(&interval, NULL);
+
+        now_ns = clock_ns();
+        made_progress = 0;
+        for(i = 0; i < num_watched_slots; ++i) {
+            word = __atomic_load_n(&(heartbeats[i].word), __ATOMIC_RELAXED);
+            if(word != last_words[i]) {
+                last_words[i] = word;
+                last_change_ns[i] = now_ns;
+                made_progress = 1;
+            }
+        }
+
+        if(made_progress) {
+            last_progress_ns = now_ns;
+            has_dumped = 0;
+
+        } else if(!has_dumped
+               && stall_threshold_ns <= now_ns - last_progress_ns) {
+            has_dumped = 1;
+            fprintf(stderr, "\nwatchdog: no progress for %.3fs\n",
+                (double) (now_ns - last_progress_ns) / NS_PER_SEC
+            );
+            dump_stall(stderr, now_ns - last_progress_ns);
+            fflush(stderr);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Start the watchdog thread.
+ *
+ * Params: - Number of heartbeat slots in use, starting at slot 0.
+ *         - How long none of the heartbeats can change before the
+ *           simulation is considered stalled.
+ *         - Function to call when the simulation has stalled.
+ *
+ * Side-Effects: If this function fails then the program will be exited.
+ */
+void watchdog_start(const int num_slots,
+                    const unsigned long stall_ns,
+                    watchdog_dump_t dump) {
+    pthread_t thread_id;
+
+    assert(0 < num_slots && num_slots <= WATCHDOG_MAX_SLOTS);
+    assert(0 < stall_ns);
+    assert(NULL != dump);
+
+    num_watched_slots = num_slots;
+    stall_threshold_ns = stall_ns;
+    dump_stall = dump;
+
+    if(0 != pthread_create(&thread_id, NULL, &watchdog, NULL)) {
+        perror("watchdog_start[pthread_create]");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread_id);
+}
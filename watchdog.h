@@ -0,0 +1,32 @@
+/*
+ * watchdog.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+#define WATCHDOG_MAX_SLOTS 256
+
+/* how often the watchdog looks at the heartbeats. */
+#define WATCHDOG_INTERVAL_NS 100000000UL
+
+/* Called once when the watchdog decides that progress has stopped; should
+ * print out whatever might explain the stall. */
+typedef void (*watchdog_dump_t)(FILE *out, const unsigned long stalled_ns);
+
+void watchdog_beat(const int slot, const int state);
+void watchdog_start(const int num_slots,
+                    const unsigned long stall_ns,
+                    watchdog_dump_t dump);
+int watchdog_state(const int slot,
+                   unsigned long *num_beats,
+                   unsigned long *idle_ns);
+
+#endif /* WATCHDOG_H_ */
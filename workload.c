@@ -0,0 +1,167 @@
+/*
+ * workload.c
+ *
+ *     Version: $Id$
+ *
+ * The built-in workloads, and loading of workloads from shared objects. The
+ * built-in workloads are:
+ *
+ *      spin        the original empty busy loop.
+ *      compute     integer arithmetic that stays in registers.
+ *      membw       streams through a buffer much larger than the caches, so
+ *                  the actors compete for memory bandwidth.
+ *      sleep       gives up the processor entirely.
+ *
+ * Anything else is taken as the path of a shared object exporting a
+ * workload_t named WORKLOAD_SYMBOL.
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include "workload.h"
+#include "alloc.h"
+
+/* size of the buffer streamed through by membw; big enough to miss in the
+ * last-level cache of most machines. */
+#define MEMBW_BUFFER_SIZE (64UL << 20)
+
+/* approximate cost of one cycle of the original busy loop, and of one trip
+ * through the compute and membw loops, in nanoseconds or cycles. */
+#define NS_PER_CYCLE 2
+#define CYCLES_PER_COMPUTE 4
+#define CYCLES_PER_CACHE_LINE 32
+#define CACHE_LINE_SIZE 64
+
+static volatile unsigned long *membw_buffer = NULL;
+static volatile unsigned long sink = 0;
+
+/**
+ * The original busy wait.
+ */
+static void spin(const int id, const unsigned int amount) {
+    unsigned int i = amount;
+    for(; i && --i; ) /* ho ho ho! */;
+}
+
+/**
+ * Integer work that never touches memory.
+ */
+static void compute(const int id, const unsigned int amount) {
+    unsigned long x = (unsigned long) id + 1;
+    unsigned int i;
+    for(i = amount / CYCLES_PER_COMPUTE; i; --i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        x *= 0x9e3779b97f4a7c15UL;
+    }
+    sink = x;
+}
+
+/**
+ * Allocate and touch the membw buffer so that page faults aren't counted
+ * against the first actors.
+ */
+static void membw_init(void) {
+    unsigned long i;
+    membw_buffer = (volatile unsigned long *) alloc_pool(
+        "membw buffer", MEMBW_BUFFER_SIZE
+    );
+    for(i = 0; i < MEMBW_BUFFER_SIZE / sizeof(unsigned long); ++i) {
+        membw_buffer[i] = i;
+    }
+}
+
+/**
+ * Read and write one word per cache line, starting at a place in the buffer
+ * that depends on the caller so that actors don't all hit the same lines.
+ */
+static void membw(const int id, const unsigned int amount) {
+    const unsigned long num_lines = MEMBW_BUFFER_SIZE / CACHE_LINE_SIZE;
+    const unsigned long stride = CACHE_LINE_SIZE / sizeof(unsigned long);
+    unsigned long line = ((unsigned long) id * 7919UL) % num_lines;
+    unsigned int i;
+
+    for(i = amount / CYCLES_PER_CACHE_LINE; i; --i) {
+        membw_buffer[line * stride] += 1;
+        if(++line == num_lines) {
+            line = 0;
+        }
+    }
+}
+
+/**
+ * Sleep for about as long as the busy loop would have taken.
+ */
+static void sleep_for(const int id, const unsigned int amount) {
+    struct timespec duration;
+    unsigned long ns = (unsigned long) amount * NS_PER_CYCLE;
+    duration.tv_sec = (time_t) (ns / 1000000000UL);
+    duration.tv_nsec = (long) (ns % 1000000000UL);
+    nanosleep(&duration, NULL);
+}
+
+static const workload_t builtin_workloads[] = {
+    {"spin", NULL, &spin, &spin, &spin},
+    {"compute", NULL, &compute, &compute, &compute},
+    {"membw", &membw_init, &membw, &membw, &membw},
+    {"sleep", NULL, &sleep_for, &sleep_for, &sleep_for}
+};
+
+#define NUM_BUILTIN_WORKLOADS \
+    ((int) (sizeof(builtin_workloads) / sizeof(builtin_workloads[0])))
+
+/**
+ * Find a workload, either by the name of a built-in one, or by the path of a
+ * shared object. The workload's init operation, if any, is called.
+ *
+ * Returns: the workload, or NULL if it couldn't be found or loaded.
+ */
+const workload_t *workload_find(const char *name) {
+    const workload_t *workload = NULL;
+    void *library;
+    int i;
+
+    assert(NULL != name);
+
+    for(i = 0; i < NUM_BUILTIN_WORKLOADS; ++i) {
+        if(!strcmp(name, builtin_workloads[i].name)) {
+            workload = &(builtin_workloads[i]);
+            break;
+        }
+    }
+
+    if(NULL == workload) {
+        library = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+        if(NULL == library) {
+            fprintf(stderr, "workload_find[dlopen]: %s\n", dlerror());
+            return NULL;
+        }
+
+        workload = (const workload_t *) dlsym(library, WORKLOAD_SYMBOL);
+        if(NULL == workload) {
+            fprintf(stderr, "workload_find[dlsym]: %s\n", dlerror());
+            return NULL;
+        }
+    }
+
+    if(NULL != workload->init) {
+        workload->init();
+    }
+
+    return workload;
+}
+
+/**
+ * Print out the names of the built-in workloads.
+ */
+void workload_list(FILE *out) {
+    int i;
+    for(i = 0; i < NUM_BUILTIN_WORKLOADS; ++i) {
+        fprintf(out, "%s%s", i ? ", " : "", builtin_workloads[i].name);
+    }
+}
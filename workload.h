@@ -0,0 +1,42 @@
+/*
+ * workload.h
+ *
+ *     Version: $Id$
+ */
+
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "assert.h"
+
+/* name of the workload_t symbol that a workload shared object must export. */
+#define WORKLOAD_SYMBOL "santa_workload"
+
+/* What the actors do while they're not synchronizing. The amount passed to
+ * each operation is a random number of "cycles" from the simulation, where a
+ * cycle is one trip through the original busy loop; a workload should take
+ * roughly that long, however it spends the time. Any operation can be NULL,
+ * in which case that actor doesn't wait at all. */
+typedef struct {
+    const char *name;
+
+    /* called once, before any actors start; allocate buffers here. */
+    void (*init)(void);
+
+    /* an elf working on toys. */
+    void (*work)(const int elf_id, const unsigned int amount);
+
+    /* santa helping an elf. */
+    void (*help)(const int elf_id, const unsigned int amount);
+
+    /* a reindeer on vacation, or out delivering presents. */
+    void (*vacation)(const int reindeer_id, const unsigned int amount);
+} workload_t;
+
+const workload_t *workload_find(const char *name);
+void workload_list(FILE *out);
+
+#endif /* WORKLOAD_H_ */